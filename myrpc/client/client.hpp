@@ -9,7 +9,8 @@ namespace client {
 class Client : public MuduoClient {
    public:
     using ptr = std::shared_ptr<Client>;
-    Client(const std::string& sip, int sport)
+    // connect_timeout_ms为建立连接的超时时间，0表示一直等到连上为止；超时后客户端保持断开状态，connected()返回false
+    Client(const std::string& sip, int sport, int connect_timeout_ms = 0)
         : MuduoClient(sip, sport),
           _dispatcher(std::make_shared<Dispatcher>()),
           _requestor(std::make_shared<Requestor>()) {
@@ -21,12 +22,42 @@ class Client : public MuduoClient {
                                 std::placeholders::_1, std::placeholders::_2);
         _dispatcher->registerHandler<BaseMessage>(MType::RSP_RPC, rsp_cb);
         _dispatcher->registerHandler<BaseMessage>(MType::RSP_SERVICE, rsp_cb);
+        _dispatcher->registerHandler<BaseMessage>(MType::RSP_RPC_BATCH, rsp_cb);
+        MuduoClient::setCloseCallback(std::bind(&Client::onClose, this, std::placeholders::_1));
+        // 超时检查的定时器只在有设置了超时的请求时运行，空闲的客户端不占用事件循环
+        _requestor->setArmCallback([this]() {
+            runInLoop([this]() { armTick(); });
+        });
 
-        connect();
+        if (connect(connect_timeout_ms) == false) {
+            return;
+        }
         _conn = connection();
         if (_conn == nullptr) {
             exit(0);
         }
+        // 只持有连接的弱引用，连接释放后不再发送取消帧
+        std::weak_ptr<BaseConnection> weak_conn = _conn;
+        _requestor->setCancelCallback([weak_conn](RequestId rid) {
+            auto conn = weak_conn.lock();
+            if (conn && conn->connected() && conn->protocol()->negotiated(CAP_CANCEL)) {
+                auto msg = MessageFactory::create<CancelRequest>();
+                msg->setId(rid);
+                conn->send(msg);
+            }
+        });
+        handshake();
+    }
+    ~Client() {
+        // 在事件循环中停止定时器，detach等待事件循环时这一步已经完成，此后定时器不会再触发
+        runInLoop([this]() {
+            _tick_closed = true;
+            if (_tick_armed) cancelTimer(_tick_timer);
+            _tick_armed = false;
+        });
+        // 先让io线程不再回调本对象，再结束在途请求，此后_dispatcher与_requestor才能安全释放
+        detach();
+        _requestor->failAll(RCode::RCODE_DISCONNECTED);
     }
 
 	template <typename T>
@@ -34,24 +65,115 @@ class Client : public MuduoClient {
 		_dispatcher->registerHandler<T>(mtype, func);
 	}
 
-    bool send(const BaseMessage::ptr& req, AsyncResponse& async_rsp) {
-        return _requestor->send(_conn, req, async_rsp);
+	// 用户的连接断开回调，在结束所有在途请求之后调用
+	// 可以在连接建立之后设置，与io线程中的断开回调互斥
+	virtual void setCloseCallback(const CloseCallback& cb) override {
+		std::unique_lock<std::mutex> lock(_close_mutex);
+		_user_close_cb = cb;
+	}
+
+    // timeout_ms为本次请求的超时时间，小于0时使用setTimeout设置的默认值，0表示不限时
+    bool send(const BaseMessage::ptr& req, AsyncResponse& async_rsp, int timeout_ms = -1) {
+        return _requestor->send(_conn, req, async_rsp, timeoutOf(timeout_ms));
     }
-    bool send(const BaseMessage::ptr& req, BaseMessage::ptr& rsp) {
-        return _requestor->send(_conn, req, rsp);
+    // 同步接口不能在本客户端的io线程(如本客户端的回调)中调用：响应要由该线程处理，等待会死锁，直接返回false
+    bool send(const BaseMessage::ptr& req, BaseMessage::ptr& rsp, int timeout_ms = -1) {
+        if (inOwnLoop()) {
+            ELOG("不能在客户端的io线程中同步等待响应，请改用异步或回调接口！");
+            return false;
+        }
+        return _requestor->send(_conn, req, rsp, timeoutOf(timeout_ms));
     }
-    bool send(const BaseMessage::ptr& req, const RequestCallback& cb) {
-        return _requestor->send(_conn, req, cb);
+    bool send(const BaseMessage::ptr& req, const RequestCallback& cb, int timeout_ms = -1) {
+        return _requestor->send(_conn, req, cb, timeoutOf(timeout_ms));
     }
+	// 取消一个已发送的请求，rid在发送后可由req->rid()获得；请求以RCODE_CANCELLED结束
+	bool cancel(RequestId rid){
+		return _requestor->cancel(rid);
+	}
+	// 请求的默认超时时间(毫秒)，0表示不限时
+	void setTimeout(int timeout_ms){
+		_timeout_ms = timeout_ms;
+	}
+
+	// 单条连接上同时在途的请求数上限，0表示不限制
+	void setMaxInFlight(size_t max_in_flight){
+		_requestor->setMaxInFlight(max_in_flight);
+	}
+	size_t inFlight(){
+		return _requestor->inFlight();
+	}
 
 	Address getHost(){
 		return _conn->getHost();
 	}
+	// 握手确认服务端支持cap
+	bool peerSupports(uint32_t cap){
+		return _conn && _conn->protocol()->negotiated(cap);
+	}
 
    private:
+	// 与服务端协商协议版本与能力；旧版本服务端不回复或回复错误时，沿用本端配置
+	void handshake() {
+		auto req = MessageFactory::create<ServiceRequest>();
+		req->setOptype(ServiceOptype::SERVICE_HANDSHAKE);
+		req->setVersion(PROTOCOL_VERSION);
+		req->setCapabilities(_conn->protocol()->capabilities() | CAP_BATCH | CAP_CANCEL);
+		AsyncResponse rsp_future;
+		if (send(std::dynamic_pointer_cast<BaseMessage>(req), rsp_future, handshakeTimeoutMs) == false) {
+			return;
+		}
+		auto rsp = std::dynamic_pointer_cast<ServiceResponse>(rsp_future.get());
+		if (rsp && rsp->rcode() == RCode::RCODE_TIMEOUT) {
+			ILOG("服务端未响应握手，按旧版本协议通信");
+			return;
+		}
+		if (rsp.get() == nullptr || rsp->rcode() != RCode::RCODE_OK || rsp->optype() != ServiceOptype::SERVICE_HANDSHAKE) {
+			ILOG("服务端不支持握手，按旧版本协议通信");
+			return;
+		}
+		_conn->protocol()->setPeerCapabilities(rsp->capabilities());
+		DLOG("握手完成：版本 %d，能力 %u", rsp->version(), rsp->capabilities());
+	}
+
+	// 以下三个函数与_tick_*只在事件循环中访问
+	void armTick() {
+		if (_tick_armed || _tick_closed) {
+			return;
+		}
+		_tick_armed = true;
+		_tick_timer = runEvery(Requestor::tickMs / 1000.0, [this]() {
+			// 时间轮空了就停止；之后新加入的超时会再次启动定时器
+			if (_requestor->onTick() == false) {
+				cancelTimer(_tick_timer);
+				_tick_armed = false;
+			}
+		});
+	}
+
+	void onClose(const BaseConnection::ptr& conn) {
+		_requestor->failAll(RCode::RCODE_DISCONNECTED);
+		CloseCallback cb;
+		{
+			std::unique_lock<std::mutex> lock(_close_mutex);
+			cb = _user_close_cb;
+		}
+		if (cb) cb(conn);
+	}
+	int timeoutOf(int timeout_ms) {
+		return timeout_ms < 0 ? _timeout_ms.load() : timeout_ms;
+	}
+
+	static const int handshakeTimeoutMs = 1000;
     Dispatcher::ptr _dispatcher;
     Requestor::ptr _requestor;
     BaseConnection::ptr _conn;
+    std::mutex _close_mutex;
+    CloseCallback _user_close_cb;
+    std::atomic<int> _timeout_ms{0};
+    muduo::net::TimerId _tick_timer;
+    bool _tick_armed = false;
+    bool _tick_closed = false;
 };
 
 }  // namespace client
@@ -1,4 +1,5 @@
 #pragma once
+#include <set>
 #include <unordered_set>
 #include "client.hpp"
 
@@ -101,6 +102,47 @@ class Discoverer {
 		}
 	}
 
+	// 为方法另找一个不在exclude中的可用主机，用于对冲请求
+	// 主机列表向注册中心单独查询(SERVICE_PROVIDERS)，不占用服务发现分配的主机，缓存providersTtlMs毫秒
+	// 收到主机更新或下线通知时缓存立即失效，失效的主机不会继续被选中
+	bool discoverAlternate(const std::string& method, const std::set<Address>& exclude, Address& host){
+		std::vector<Address> hosts;
+		if(providers(method, hosts) == false){
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		// 轮流选择，对冲请求分散到各个主机上
+		size_t start = _alternate_next[method]++;
+		for(size_t i = 0; i < hosts.size(); i++){
+			auto& candidate = hosts[(start + i) % hosts.size()];
+			if(exclude.count(candidate) == 0){
+				host = candidate;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 方法当前所有可用的主机
+	bool providers(const std::string& method, std::vector<Address>& hosts){
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			auto it = _providers.find(method);
+			if(it != _providers.end() && std::chrono::steady_clock::now() < it->second.expire){
+				hosts = it->second.hosts;
+				return true;
+			}
+		}
+		if(requestHosts(method, hosts) == false){
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		auto& cached = _providers[method];
+		cached.hosts = hosts;
+		cached.expire = std::chrono::steady_clock::now() + std::chrono::milliseconds(providersTtlMs);
+		return true;
+	}
+
 	void setOnServiceFirstDiscover(const onServiceFirstDiscover& cb){
 		_service_first_discover_cb = cb;
 	}
@@ -123,6 +165,7 @@ class Discoverer {
 			ILOG("服务 %s 更新：%s:%d", method.c_str(), host.first.c_str(), host.second);
 			std::unique_lock<std::mutex> lock(_mutex);
 			_method_host[method] = host;
+			_providers.erase(method);  // 原主机失效才会收到更新
 			if(_service_update_cb){
 				_service_update_cb(method, host);
 			}
@@ -131,6 +174,7 @@ class Discoverer {
 			ILOG("服务 %s 下线", method.c_str());
 			std::unique_lock<std::mutex> lock(_mutex);
 			_method_host.erase(method);
+			_providers.erase(method);
 			if(_service_lapse_cb){
 				_service_lapse_cb(method);
 			}
@@ -140,6 +184,27 @@ class Discoverer {
 	}
 
 	bool discoverService(const std::string& method){
+		Address host;
+		RCode rcode;
+		if(requestHost(method, host, rcode) == false){
+			if(rcode == RCode::RCODE_NOT_FOUND_SERVICE){
+				std::unique_lock<std::mutex> lock(_mutex);
+				_visted.insert(method);
+			}
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		_visted.insert(method);
+		_method_host[method] = host;
+		if(_service_first_discover_cb){
+			_service_first_discover_cb(method, host);
+		}
+		return true;
+	}
+
+	// 向注册中心发送一次服务发现请求，rcode为注册中心返回的状态码
+	bool requestHost(const std::string& method, Address& host, RCode& rcode){
+		rcode = RCode::RCODE_INTERNAL_ERROR;
 		auto msg_req = MessageFactory::create<ServiceRequest>();
 		//msg_req->setId(UUID::uuid());
 		msg_req->setMType(MType::REQ_SERVICE);
@@ -156,26 +221,50 @@ class Discoverer {
 			ELOG("响应类型向下转换失败！");
 			return false;
 		}
-		if(service_rsp->rcode() != RCode::RCODE_OK){
-			ELOG("服务发现失败，原因：%s", errReason(service_rsp->rcode()).c_str());
-			if(service_rsp->rcode() == RCode::RCODE_NOT_FOUND_SERVICE){
-				std::unique_lock<std::mutex> lock(_mutex);
-				_visted.insert(method);
-			}
+		rcode = service_rsp->rcode();
+		if(rcode != RCode::RCODE_OK){
+			ELOG("服务发现失败，原因：%s", errReason(rcode).c_str());
 			return false;
 		}
-		std::unique_lock<std::mutex> lock(_mutex);
-		_visted.insert(method);
-		_method_host[method] = service_rsp->host();
-		if(_service_first_discover_cb){
-			_service_first_discover_cb(method, service_rsp->host());
+		host = service_rsp->host();
+		return true;
+	}
+
+	// 向注册中心查询方法的所有可用主机
+	bool requestHosts(const std::string& method, std::vector<Address>& hosts){
+		auto msg_req = MessageFactory::create<ServiceRequest>();
+		msg_req->setMType(MType::REQ_SERVICE);
+		msg_req->setMethod(method);
+		msg_req->setOptype(ServiceOptype::SERVICE_PROVIDERS);
+		BaseMessage::ptr msg_rsp;
+		if(_client->send(msg_req, msg_rsp) == false){
+			ELOG("%s 主机列表请求发送失败！", method.c_str());
+			return false;
+		}
+		auto service_rsp = std::dynamic_pointer_cast<ServiceResponse>(msg_rsp);
+		if(service_rsp.get() == nullptr){
+			ELOG("响应类型向下转换失败！");
+			return false;
+		}
+		if(service_rsp->rcode() != RCode::RCODE_OK){
+			// 旧版本的注册中心不支持查询主机列表
+			ELOG("查询 %s 主机列表失败，原因：%s", method.c_str(), errReason(service_rsp->rcode()).c_str());
+			return false;
 		}
+		hosts = service_rsp->hosts();
 		return true;
 	}
 
+	struct Providers {
+		std::vector<Address> hosts;
+		std::chrono::steady_clock::time_point expire;
+	};
+	static constexpr int providersTtlMs = 1000;
 	std::mutex _mutex;
 	Client::ptr _client;
 	std::unordered_map<std::string, Address> _method_host;
+	std::unordered_map<std::string, Providers> _providers;  // 方法的所有可用主机，用于对冲请求
+	std::unordered_map<std::string, size_t> _alternate_next;
 	std::unordered_set<std::string> _visted;
 	onServiceFirstDiscover _service_first_discover_cb;
 	onServiceUpdate _service_update_cb;
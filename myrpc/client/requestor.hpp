@@ -1,99 +1,301 @@
 #pragma once
+#include <condition_variable>
 #include <functional>
 #include <future>
 #include "../common/message.hpp"
 #include "../common/net.hpp"
+#include "../common/timer_wheel.hpp"
 
 namespace myrpc {
 namespace client {
 
 using RequestCallback = std::function<void(const BaseMessage::ptr&)>;
 using AsyncResponse = std::future<BaseMessage::ptr>;
+using CancelCallback = std::function<void(RequestId)>;
 	
 class Requestor {
    public:
     using ptr = std::shared_ptr<Requestor>;
+    // 同步调用的等待者，每个线程同一时刻只有一个同步调用，因此按线程复用，不必每次创建promise
+    struct SyncWaiter {
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool ready = false;
+        BaseMessage::ptr response;
+    };
     struct RequestDescribe {
-        using ptr = std::shared_ptr<RequestDescribe>;
-        BaseMessage::ptr request;
         RType rtype;
+        MType mtype;  // 请求的消息类型，超时或断开时据此构造对应的错误响应
         std::promise<BaseMessage::ptr> response;
         RequestCallback callback;
+        SyncWaiter* waiter = nullptr;
     };
+    Requestor()
+        : _timer_wheel(std::make_shared<TimerWheel<RequestId>>(tickMs, slotCount,
+                                                               std::bind(&Requestor::onExpire, this, std::placeholders::_1))) {}
     void onResponse(const BaseConnection::ptr& conn, BaseMessage::ptr& msg) {
-        std::string rid = msg->rid();
-        RequestDescribe::ptr rdp = getDescribe(rid);
-        if (rdp.get() == nullptr) {
-            ELOG("收到响应 - %s，但是未找到对应的请求描述！", rid.c_str());
+        RequestId rid = msg->rid();
+        RequestDescribe rd;
+        // 查找与删除在同一次加锁中完成，同时释放在途窗口，回调中可以继续发起新的请求
+        if (take(rid, rd) == false) {
+            DLOG("收到响应 - %lu，但是未找到对应的请求描述，请求可能已超时！", rid);
             return;
         }
-        if (rdp->rtype == RType::REQ_ASYNC) {
-            rdp->response.set_value(msg);
-        } else if (rdp->rtype == RType::REQ_CALLBACK) {
-            if (rdp->callback)
-                rdp->callback(msg);
+        complete(rd, msg);
+    }
+    // 超时检查，由客户端的事件循环每隔tickMs毫秒调用一次；返回false表示已没有待检查的超时，可以停止定时器
+    bool onTick() {
+        _timer_wheel->tick();
+        return _timer_wheel->size() > 0;
+    }
+    // 时间轮由空变为非空时调用，客户端据此启动超时检查的定时器；没有设置超时的请求不需要定时器
+    void setArmCallback(const std::function<void()>& cb) {
+        _arm_cb = cb;
+    }
+    // 连接断开时，以rcode结束所有在途请求；此后发送的请求不再登记，直接以RCODE_DISCONNECTED结束
+    void failAll(RCode rcode) {
+        _closed.store(true);
+        std::vector<std::pair<RequestId, RequestDescribe>> failed;
+        for (auto& shard : _shards) {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            for (auto& it : shard.pending) {
+                failed.emplace_back(it.first, std::move(it.second));
+            }
+            shard.pending.clear();
+        }
+        if (failed.empty() == false) {
+            ILOG("结束 %zu 个在途请求：%s", failed.size(), errReason(rcode).c_str());
+        }
+        for (auto& it : failed) {
+            complete(it.second, errorResponse(it.second.mtype, it.first, rcode));
+        }
+    }
+    // 放弃等待一个在途请求：请求以RCODE_CANCELLED结束，并通知服务端停止处理
+    bool cancel(RequestId rid) {
+        RequestDescribe rd;
+        if (take(rid, rd) == false) {
+            return false;  // 已经收到响应或已超时
+        }
+        complete(rd, errorResponse(rd.mtype, rid, RCode::RCODE_CANCELLED));
+        if (_cancel_cb) _cancel_cb(rid);
+        return true;
+    }
+    // 请求被取消或超时后调用，用于向服务端发送取消帧
+    void setCancelCallback(const CancelCallback& cb) {
+        _cancel_cb = cb;
+    }
+    // 限制连接上同时在途的请求数量，0表示不限制
+    // 窗口已满时发送方阻塞等待响应释放窗口；io线程中发送的请求不能等待(响应要由io线程处理)，直接以RCODE_OVERLOADED结束
+    void setMaxInFlight(size_t max_in_flight) {
+        std::unique_lock<std::mutex> lock(_window_mutex);
+        _max_in_flight.store(max_in_flight);
+        _window_cond.notify_all();
+    }
+    size_t inFlight() {
+        return _in_flight.load();
+    }
+    // 以下发送接口中timeout_ms为请求的超时时间，0表示不限时
+    // 超时后请求以RCODE_TIMEOUT结束，超时时间同时写入请求中，供服务端丢弃过期的请求
+    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, AsyncResponse& async_rsp, int timeout_ms = 0) {
+        RequestDescribe rd;
+        rd.rtype = RType::REQ_ASYNC;
+        async_rsp = rd.response.get_future();
+        if (newDescribe(conn, req, std::move(rd), timeout_ms)) {
+            conn->send(req);
+        }
+        return true;
+    }
+    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, BaseMessage::ptr& rsp, int timeout_ms = 0) {
+        static thread_local SyncWaiter waiter;
+        waiter.ready = false;
+        RequestDescribe rd;
+        rd.rtype = RType::REQ_SYNC;
+        rd.waiter = &waiter;
+        if (newDescribe(conn, req, std::move(rd), timeout_ms)) {
+            conn->send(req);
+        }
+        std::unique_lock<std::mutex> lock(waiter.mutex);
+        waiter.cond.wait(lock, []() { return waiter.ready; });
+        rsp = std::move(waiter.response);
+        return true;
+    }
+    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, const RequestCallback& cb, int timeout_ms = 0) {
+        RequestDescribe rd;
+        rd.rtype = RType::REQ_CALLBACK;
+        rd.callback = cb;
+        if (newDescribe(conn, req, std::move(rd), timeout_ms)) {
+            conn->send(req);
+        }
+        return true;
+    }
+
+    static constexpr int tickMs = 10;
+
+   private:
+    void onExpire(RequestId rid) {
+        RequestDescribe rd;
+        if (take(rid, rd) == false) {
+            return;  // 已经收到响应
+        }
+        ELOG("请求 %lu 超时！", rid);
+        complete(rd, errorResponse(rd.mtype, rid, RCode::RCODE_TIMEOUT));
+        // 调用方已不再等待，服务端没有必要继续处理
+        if (_cancel_cb) _cancel_cb(rid);
+    }
+    void complete(RequestDescribe& rd, const BaseMessage::ptr& msg) {
+        releaseSlot();
+        deliver(rd, msg);
+    }
+    // 把响应交给等待方，不归还窗口
+    void deliver(RequestDescribe& rd, const BaseMessage::ptr& msg) {
+        if (rd.rtype == RType::REQ_SYNC) {
+            std::unique_lock<std::mutex> lock(rd.waiter->mutex);
+            rd.waiter->response = msg;
+            rd.waiter->ready = true;
+            rd.waiter->cond.notify_one();
+        } else if (rd.rtype == RType::REQ_ASYNC) {
+            rd.response.set_value(msg);
+        } else if (rd.rtype == RType::REQ_CALLBACK) {
+            if (rd.callback)
+                rd.callback(msg);
         } else {
             ELOG("请求类型未知！！");
         }
-        delDescribe(rid);
     }
-    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, AsyncResponse& async_rsp) {
-        RequestDescribe::ptr rdp = newDescribe(req, RType::REQ_ASYNC);
-        if (rdp.get() == nullptr) {
-            ELOG("构造请求描述对象失败！");
-            return false;
+    // 为超时或断开的请求构造与请求类型对应的错误响应
+    static BaseMessage::ptr errorResponse(MType mtype, RequestId rid, RCode rcode) {
+        JsonResponse::ptr rsp;
+        switch (mtype) {
+            case MType::REQ_SERVICE:
+                rsp = std::make_shared<ServiceResponse>();
+                break;
+            case MType::REQ_RPC_BATCH:
+                rsp = std::make_shared<BatchResponse>();
+                break;
+            default:
+                rsp = std::make_shared<RpcResponse>();
+                break;
         }
-        conn->send(req);
-        async_rsp = rdp->response.get_future();
-        return true;
+        rsp->setId(rid);
+        rsp->setRCode(rcode);
+        return rsp;
     }
-    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, BaseMessage::ptr& rsp) {
-        AsyncResponse rsp_future;
-        bool ret = send(conn, req, rsp_future);
-        if (ret == false) {
+
+    // 在途请求表按请求id分片，每个分片各自加锁；请求id连续递增，请求会均匀落在各个分片上
+    // 删除的哈希节点留在分片中复用，稳定运行时插入与删除都不再分配内存
+    struct Shard {
+        using Table = std::unordered_map<RequestId, RequestDescribe>;
+        std::mutex mutex;
+        Table pending;
+        std::vector<Table::node_type> free_nodes;
+    };
+
+    // 登记在途请求，连接已断开时直接以RCODE_DISCONNECTED结束请求并返回false，不再发送
+    bool newDescribe(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, RequestDescribe&& rd, int timeout_ms) {
+        bool slot = acquireSlot();
+        // 每个Requestor对应一条连接，请求id在连接内递增分配即可保证唯一
+        RequestId rid = _seq.fetch_add(1, std::memory_order_relaxed) + 1;
+        req->setId(rid);
+        rd.mtype = req->mtype();
+        if (slot == false) {
+            ELOG("在途请求已满，io线程中不能等待窗口，请求 %lu 直接结束", rid);
+            deliver(rd, errorResponse(rd.mtype, rid, RCode::RCODE_OVERLOADED));
             return false;
         }
-        rsp = rsp_future.get();
+        if (timeout_ms > 0) {
+            auto json_req = std::dynamic_pointer_cast<JsonRequest>(req);
+            if (json_req) json_req->setTimeout(timeout_ms);
+        }
+        {
+            Shard& shard = _shards[rid % shardCount];
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            // 在分片锁内检查：failAll先置位_closed再逐个分片清理，这里看不到置位时登记的请求一定会被failAll结束
+            if (_closed.load() || conn.get() == nullptr || conn->connected() == false) {
+                lock.unlock();
+                DLOG("连接已断开，请求 %lu 直接结束", rid);
+                complete(rd, errorResponse(rd.mtype, rid, RCode::RCODE_DISCONNECTED));
+                return false;
+            }
+            if (shard.free_nodes.empty()) {
+                shard.pending.emplace(rid, std::move(rd));
+            } else {
+                auto node = std::move(shard.free_nodes.back());
+                shard.free_nodes.pop_back();
+                node.key() = rid;
+                node.mapped() = std::move(rd);
+                shard.pending.insert(std::move(node));
+            }
+        }
+        if (timeout_ms > 0 && _timer_wheel->add(timeout_ms, rid) && _arm_cb) {
+            _arm_cb();
+        }
         return true;
     }
-    bool send(const BaseConnection::ptr& conn, const BaseMessage::ptr& req, const RequestCallback& cb) {
-        RequestDescribe::ptr rdp = newDescribe(req, RType::REQ_CALLBACK, cb);
-        if (rdp.get() == nullptr) {
-            ELOG("构造请求描述对象失败！");
+    bool take(RequestId rid, RequestDescribe& rd) {
+        Shard& shard = _shards[rid % shardCount];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.pending.find(rid);
+        if (it == shard.pending.end()) {
             return false;
         }
-        conn->send(req);
+        rd = std::move(it->second);
+        auto node = shard.pending.extract(it);
+        if (shard.free_nodes.size() < maxFreeNodes) {
+            node.mapped() = RequestDescribe();
+            shard.free_nodes.push_back(std::move(node));
+        }
         return true;
     }
 
-   private:
-    RequestDescribe::ptr newDescribe(const BaseMessage::ptr& req, RType rtype, const RequestCallback& cb = RequestCallback()) {
-        std::unique_lock<std::mutex> lock(_mutex);
-        RequestDescribe::ptr rd = std::make_shared<RequestDescribe>();
-        rd->request = req;
-        rd->rtype = rtype;
-        if (rtype == RType::REQ_CALLBACK && cb) {
-            rd->callback = cb;
+    // 在途窗口：计数使用原子变量，只有窗口已满时才进入互斥锁等待
+    // 窗口已满且当前线程是io线程时返回false：释放窗口的响应需要io线程处理，在io线程中等待会死锁
+    bool acquireSlot() {
+        size_t cur = _in_flight.load();
+        while (true) {
+            size_t max = _max_in_flight.load();
+            if (max == 0 || cur < max) {
+                if (_in_flight.compare_exchange_weak(cur, cur + 1)) return true;
+                continue;
+            }
+            if (muduo::net::EventLoop::getEventLoopOfCurrentThread() != nullptr) {
+                return false;
+            }
+            _window_waiters.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> lock(_window_mutex);
+                _window_cond.wait(lock, [this]() {
+                    size_t max = _max_in_flight.load();
+                    return max == 0 || _in_flight.load() < max;
+                });
+            }
+            _window_waiters.fetch_sub(1);
+            cur = _in_flight.load();
         }
-        _request_desc.insert(std::make_pair(req->rid(), rd));
-        return rd;
     }
-    RequestDescribe::ptr getDescribe(const std::string& rid) {
-        std::unique_lock<std::mutex> lock(_mutex);
-        auto it = _request_desc.find(rid);
-        if (it == _request_desc.end()) {
-            return RequestDescribe::ptr();
+    void releaseSlot() {
+        _in_flight.fetch_sub(1);
+        if (_window_waiters.load() > 0) {
+            std::unique_lock<std::mutex> lock(_window_mutex);
+            _window_cond.notify_one();
         }
-        return it->second;
-    }
-    void delDescribe(const std::string& rid) {
-        std::unique_lock<std::mutex> lock(_mutex);
-        _request_desc.erase(rid);
     }
 
    private:
-    std::mutex _mutex;
-    std::unordered_map<std::string, RequestDescribe::ptr> _request_desc;
+    static constexpr size_t slotCount = 1024;  // 时间轮一圈约10秒
+    static const size_t shardCount = 16;
+    static const size_t maxFreeNodes = 256;
+    static const size_t defaultMaxInFlight = 1024;
+    Shard _shards[shardCount];
+    std::atomic<RequestId> _seq{0};
+    std::atomic<bool> _closed{false};  // 连接已断开
+    std::atomic<size_t> _in_flight{0};
+    std::atomic<size_t> _max_in_flight{defaultMaxInFlight};
+    std::atomic<size_t> _window_waiters{0};
+    std::mutex _window_mutex;
+    std::condition_variable _window_cond;  // 在途窗口有空位时唤醒等待的发送方
+    TimerWheel<RequestId>::ptr _timer_wheel;  // 请求超时检查
+    CancelCallback _cancel_cb;
+    std::function<void()> _arm_cb;
 };
 }  // namespace client
-}  // namespace myrpc
\ No newline at end of file
+}  // namespace myrpc
@@ -0,0 +1,96 @@
+#pragma once
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "../common/detail.hpp"
+
+namespace myrpc {
+namespace client {
+
+// 单个方法的响应缓存：按参数缓存调用结果，超过ttl的结果视为过期，超过容量时淘汰最久未使用的结果
+// 只应对幂等、读多写少的方法开启
+class ResponseCache {
+   public:
+    using ptr = std::shared_ptr<ResponseCache>;
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t size = 0;
+    };
+    ResponseCache(int ttl_ms, size_t capacity) : _ttl(std::chrono::milliseconds(ttl_ms)), _capacity(capacity == 0 ? 1 : capacity) {}
+
+    // 以规范化的参数作为键：jsoncpp的对象成员按名称有序存放，紧凑格式的编码结果与成员的插入顺序无关
+    static std::string keyOf(const Json::Value& params) {
+        std::string key;
+        JSON::append(params, key);
+        return key;
+    }
+    bool get(const std::string& key, Json::Value& result) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if (it == _entries.end()) {
+            _misses++;
+            return false;
+        }
+        if (Clock::now() >= it->second->expire) {
+            _lru.erase(it->second);
+            _entries.erase(it);
+            _misses++;
+            return false;
+        }
+        _lru.splice(_lru.begin(), _lru, it->second);
+        result = it->second->result;
+        _hits++;
+        return true;
+    }
+    void put(const std::string& key, const Json::Value& result) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto expire = Clock::now() + _ttl;
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+            it->second->result = result;
+            it->second->expire = expire;
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return;
+        }
+        if (_entries.size() >= _capacity) {
+            _entries.erase(_lru.back().key);
+            _lru.pop_back();
+        }
+        _lru.push_front(Entry{key, result, expire});
+        _entries[key] = _lru.begin();
+    }
+    void clear() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _entries.clear();
+        _lru.clear();
+    }
+    Stats stats() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        Stats st;
+        st.hits = _hits;
+        st.misses = _misses;
+        st.size = _entries.size();
+        return st;
+    }
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry {
+        std::string key;
+        Json::Value result;
+        Clock::time_point expire;
+    };
+
+    std::mutex _mutex;
+    Clock::duration _ttl;
+    size_t _capacity;
+    std::list<Entry> _lru;  // 表头为最近使用
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;
+    size_t _hits = 0;
+    size_t _misses = 0;
+};
+
+}  // namespace client
+}  // namespace myrpc
@@ -1,24 +1,208 @@
 #pragma once
+#include <optional>
+#include "../common/traits.hpp"
 #include "client.hpp"
+#include "rpc_cache.hpp"
 
 namespace myrpc {
 namespace client {
 
-class RpcClient : public Client {
+// 异步调用的结果：状态码与调用结果
+using RpcResult = std::pair<RCode, Json::Value>;
+using AsyncRpcResult = std::future<RpcResult>;
+using RpcCallback = std::function<void(RCode, const Json::Value&)>;
+
+class PreparedCall;
+
+class RpcClient : public Client, public std::enable_shared_from_this<RpcClient> {
    public:
     using ptr = std::shared_ptr<RpcClient>;
-    RpcClient(const std::string& sip, int sport) : Client(sip, sport) {}
+    RpcClient(const std::string& sip, int sport, int connect_timeout_ms = 0) : Client(sip, sport, connect_timeout_ms) {}
+
+	// timeout_ms为本次调用的超时时间，小于0时使用setTimeout设置的默认值，0表示不限时
+	bool call(const std::string& method, const Json::Value& params, Json::Value& result, int timeout_ms = -1) {
+		return cachedCall(method, params, [&]() { return makeRequest(method, params); }, result, timeout_ms);
+    }
+
+	// 异步调用：发送后立即返回，不等待响应；同一线程可以连续发起多个调用，在途数量受setMaxInFlight限制
+	// 回调在io线程中执行，不要在回调中做阻塞操作；命中缓存时回调在调用线程中直接执行
+	bool asyncCall(const std::string& method, const Json::Value& params, const RpcCallback& cb, int timeout_ms = -1) {
+		return cachedAsyncCall(method, params, [&]() { return makeRequest(method, params); }, cb, timeout_ms);
+	}
+	bool asyncCall(const std::string& method, const Json::Value& params, AsyncRpcResult& result, int timeout_ms = -1) {
+		auto promise = std::make_shared<std::promise<RpcResult>>();
+		result = promise->get_future();
+		return asyncCall(method, params, [promise](RCode rcode, const Json::Value& res) {
+			promise->set_value(RpcResult(rcode, res));
+		}, timeout_ms);
+	}
+
+	// 类型化异步调用：结果转换为R后交给回调，失败时回调收到对应的状态码与R的默认值
+	// client->asyncCall<int64_t>("Add", [](myrpc::RCode rcode, const int64_t& sum){ ... }, 11, 22);
+	template <typename R, typename... Args>
+	bool asyncCall(const std::string& method, const std::function<void(RCode, const R&)>& cb, const Args&... args) {
+		return asyncCall(method, packParams(args...), [cb](RCode rcode, const Json::Value& result) {
+			if (rcode != RCode::RCODE_OK) {
+				return cb(rcode, R());
+			}
+			if (JsonTraits<R>::check(result) == false) {
+				ELOG("rpc响应结果类型与期望类型不一致！");
+				return cb(RCode::RCODE_INVALID_MSG, R());
+			}
+			cb(rcode, JsonTraits<R>::as(result));
+		});
+	}
+	template <typename R, typename... Args>
+	bool asyncCall(const std::string& method, std::future<std::pair<RCode, R>>& result, const Args&... args) {
+		auto promise = std::make_shared<std::promise<std::pair<RCode, R>>>();
+		result = promise->get_future();
+		std::function<void(RCode, const R&)> cb = [promise](RCode rcode, const R& res) {
+			promise->set_value(std::make_pair(rcode, res));
+		};
+		return asyncCall<R>(method, cb, args...);
+	}
 
-	bool call(const std::string& method, const Json::Value& params, Json::Value& result) {
+	// 批量调用：多个调用打包成一个请求帧，由服务端并行执行后一次性返回，results与calls一一对应
+	// 服务端不支持批量调用时退化为逐个调用；返回false表示请求本身失败，单个调用的错误见各自的RCode
+	bool batchCall(const std::vector<std::pair<std::string, Json::Value>>& calls,
+	               std::vector<std::pair<RCode, Json::Value>>& results) {
+		results.clear();
+		results.reserve(calls.size());
+		if (peerSupports(CAP_BATCH) == false) {
+			for (auto& call : calls) {
+				RCode rcode;
+				Json::Value result;
+				if (request(call.first, call.second, rcode, result) == false) {
+					return false;
+				}
+				results.emplace_back(rcode, std::move(result));
+			}
+			return true;
+		}
+		auto req_msg = MessageFactory::create<BatchRequest>();
+		for (auto& call : calls) {
+			req_msg->addCall(call.first, call.second);
+		}
+		BaseMessage::ptr rsp_msg;
+		if (send(std::dynamic_pointer_cast<BaseMessage>(req_msg), rsp_msg) == false) {
+			ELOG("批量Rpc请求失败！");
+			return false;
+		}
+		auto batch_rsp_msg = std::dynamic_pointer_cast<BatchResponse>(rsp_msg);
+		if (!batch_rsp_msg) {
+			ELOG("批量rpc响应，向下类型转换失败！");
+			return false;
+		}
+		if (batch_rsp_msg->rcode() != RCode::RCODE_OK) {
+			ELOG("批量rpc请求出错：%s", errReason(batch_rsp_msg->rcode()).c_str());
+			return false;
+		}
+		const Json::Value& items = batch_rsp_msg->results();
+		if (items.size() != calls.size()) {
+			ELOG("批量rpc响应的结果数量与请求不一致！");
+			return false;
+		}
+		for (auto& item : items) {
+			results.emplace_back((RCode)item[KEY_RCODE].asInt(), item[KEY_RESULT]);
+		}
+		return true;
+	}
+
+	// 为方法开启客户端响应缓存：参数相同的调用在ttl_ms内直接返回缓存的结果，不再发送请求
+	// 只缓存成功的结果，只应对幂等、读多写少的方法开启；重复开启会清空原有缓存
+	void enableCache(const std::string& method, int ttl_ms, size_t capacity = defaultCacheCapacity) {
+		std::unique_lock<std::mutex> lock(_cache_mutex);
+		_caches[method] = std::make_shared<ResponseCache>(ttl_ms, capacity);
+		_has_cache = true;
+	}
+	void disableCache(const std::string& method) {
+		std::unique_lock<std::mutex> lock(_cache_mutex);
+		_caches.erase(method);
+		_has_cache = _caches.empty() == false;
+	}
+	// 方法的缓存命中与未命中次数；方法未开启缓存时全部为0
+	ResponseCache::Stats cacheStats(const std::string& method) {
+		auto cache = cacheOf(method);
+		return cache ? cache->stats() : ResponseCache::Stats();
+	}
+
+	// 预编码一个方法的调用，反复调用同一方法时省去方法名部分与帧头的编码；客户端需要由shared_ptr管理
+	// auto add = client->prepare("Add"); auto sum = add.call<int64_t>(11, 22);
+	PreparedCall prepare(const std::string& method);
+
+	// 类型化调用：参数按位置传递，结果转换为R，失败时返回空
+	// auto sum = client->call<int64_t>("Add", 11, 22);
+	template <typename R, typename... Args>
+	std::optional<R> call(const std::string& method, const Args&... args) {
+		Json::Value result;
+		if (call(method, packParams(args...), result) == false) {
+			return std::nullopt;
+		}
+		if (JsonTraits<R>::check(result) == false) {
+			ELOG("rpc响应结果类型与期望类型不一致！");
+			return std::nullopt;
+		}
+		return JsonTraits<R>::as(result);
+	}
+
+   private:
+	friend class PreparedCall;
+	// 带缓存的同步调用，未命中缓存时才通过make构造请求
+	template <typename MakeRequest>
+	bool cachedCall(const std::string& method, const Json::Value& params, const MakeRequest& make, Json::Value& result, int timeout_ms) {
+		std::string key;
+		auto cache = cacheOf(method);
+		if (cache) {
+			key = ResponseCache::keyOf(params);
+			if (cache->get(key, result)) return true;
+		}
+        RCode rcode;
+        Json::Value rsp_result;
+        if (request(make(), rcode, rsp_result, timeout_ms) == false) {
+            return false;
+        }
+        if (rcode != RCode::RCODE_OK) {
+            ELOG("rpc请求出错：%s", errReason(rcode).c_str());
+            return false;
+        }
+		if (cache) cache->put(key, rsp_result);
+        result.swap(rsp_result);
+        return true;
+	}
+	template <typename MakeRequest>
+	bool cachedAsyncCall(const std::string& method, const Json::Value& params, const MakeRequest& make, const RpcCallback& cb, int timeout_ms) {
+		auto cache = cacheOf(method);
+		if (!cache) {
+			return asyncRequest(make(), cb, timeout_ms);
+		}
+		std::string key = ResponseCache::keyOf(params);
+		Json::Value result;
+		if (cache->get(key, result)) {
+			cb(RCode::RCODE_OK, result);
+			return true;
+		}
+		return asyncRequest(make(), [cache, key, cb](RCode rcode, const Json::Value& res) {
+			if (rcode == RCode::RCODE_OK) cache->put(key, res);
+			cb(rcode, res);
+		}, timeout_ms);
+	}
+	ResponseCache::ptr cacheOf(const std::string& method) {
+		if (_has_cache.load() == false) {
+			return ResponseCache::ptr();
+		}
+		std::unique_lock<std::mutex> lock(_cache_mutex);
+		auto it = _caches.find(method);
+		return it == _caches.end() ? ResponseCache::ptr() : it->second;
+	}
+	// 发送单个rpc请求并等待响应，返回false表示请求本身失败
+	bool request(const std::string& method, const Json::Value& params, RCode& rcode, Json::Value& result, int timeout_ms = -1) {
         // 1. 组织请求
-        auto req_msg = MessageFactory::create<RpcRequest>();
-        //req_msg->setId(UUID::uuid());
-        req_msg->setMType(MType::REQ_RPC);
-        req_msg->setMethod(method);
-        req_msg->setParams(params);
+        return request(makeRequest(method, params), rcode, result, timeout_ms);
+	}
+	bool request(const RpcRequest::ptr& req_msg, RCode& rcode, Json::Value& result, int timeout_ms = -1) {
         BaseMessage::ptr rsp_msg;
         // 2. 发送请求
-        bool ret = send(std::dynamic_pointer_cast<BaseMessage>(req_msg), rsp_msg);
+        bool ret = send(std::dynamic_pointer_cast<BaseMessage>(req_msg), rsp_msg, timeout_ms);
         if (ret == false) {
             ELOG("同步Rpc请求失败！");
             return false;
@@ -29,14 +213,92 @@ class RpcClient : public Client {
             ELOG("rpc响应，向下类型转换失败！");
             return false;
         }
-        if (rpc_rsp_msg->rcode() != RCode::RCODE_OK) {
-            ELOG("rpc请求出错：%s", errReason(rpc_rsp_msg->rcode()).c_str());
-            return false;
-        }
+        rcode = rpc_rsp_msg->rcode();
         result = rpc_rsp_msg->result();
         return true;
+	}
+	bool asyncRequest(const RpcRequest::ptr& req_msg, const RpcCallback& cb, int timeout_ms) {
+		auto rsp_cb = [cb](const BaseMessage::ptr& msg) {
+			auto rpc_rsp_msg = std::dynamic_pointer_cast<RpcResponse>(msg);
+			if (!rpc_rsp_msg) {
+				ELOG("rpc响应，向下类型转换失败！");
+				return cb(RCode::RCODE_INVALID_MSG, Json::Value());
+			}
+			cb(rpc_rsp_msg->rcode(), rpc_rsp_msg->result());
+		};
+		if (send(std::dynamic_pointer_cast<BaseMessage>(req_msg), rsp_cb, timeout_ms) == false) {
+			ELOG("异步Rpc请求失败！");
+			return false;
+		}
+		return true;
+	}
+	RpcRequest::ptr makeRequest(const std::string& method, const Json::Value& params) {
+        auto req_msg = MessageFactory::create<RpcRequest>();
+        req_msg->setMType(MType::REQ_RPC);
+        req_msg->setMethod(method);
+        req_msg->setParams(params);
+        return req_msg;
+	}
+
+	static const size_t defaultCacheCapacity = 1024;
+	std::mutex _cache_mutex;
+	std::unordered_map<std::string, ResponseCache::ptr> _caches;
+	std::atomic<bool> _has_cache{false};  // 没有方法开启缓存时跳过查找
+};
+
+// 绑定到一个方法的预编码调用：方法名部分只在prepare时编码一次，帧头在第一次发送时缓存，每次调用只编码参数
+// 由RpcClient::prepare创建，只持有客户端的弱引用，客户端释放后调用直接失败；可以在多个线程中同时使用
+class PreparedCall {
+   public:
+    PreparedCall(const std::weak_ptr<RpcClient>& client, const std::string& method)
+        : _client(client), _header(PreparedRpcRequest::prepare(method)) {}
+
+    bool call(const Json::Value& params, Json::Value& result, int timeout_ms = -1) {
+        auto client = _client.lock();
+        if (client.get() == nullptr) {
+            ELOG("%s 预编码调用的客户端已释放！", method().c_str());
+            return false;
+        }
+        return client->cachedCall(method(), params, [&]() { return makeRequest(params); }, result, timeout_ms);
+    }
+    template <typename R, typename... Args>
+    std::optional<R> call(const Args&... args) {
+        Json::Value result;
+        if (call(packParams(args...), result) == false) {
+            return std::nullopt;
+        }
+        if (JsonTraits<R>::check(result) == false) {
+            ELOG("rpc响应结果类型与期望类型不一致！");
+            return std::nullopt;
+        }
+        return JsonTraits<R>::as(result);
+    }
+    bool asyncCall(const Json::Value& params, const RpcCallback& cb, int timeout_ms = -1) {
+        auto client = _client.lock();
+        if (client.get() == nullptr) {
+            ELOG("%s 预编码调用的客户端已释放！", method().c_str());
+            return false;
+        }
+        return client->cachedAsyncCall(method(), params, [&]() { return makeRequest(params); }, cb, timeout_ms);
+    }
+    const std::string& method() {
+        return _header->method;
     }
+
+   private:
+    RpcRequest::ptr makeRequest(const Json::Value& params) {
+        auto req_msg = std::make_shared<PreparedRpcRequest>(_header);
+        req_msg->setParams(params);
+        return req_msg;
+    }
+
+    std::weak_ptr<RpcClient> _client;
+    PreparedRpcRequest::Header::ptr _header;
 };
 
+inline PreparedCall RpcClient::prepare(const std::string& method) {
+    return PreparedCall(weak_from_this(), method);
+}
+
 }  // namespace client
 }  // namespace myrpc
\ No newline at end of file
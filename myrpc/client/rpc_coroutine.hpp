@@ -0,0 +1,165 @@
+#pragma once
+// 需要以 -std=c++20 编译
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include "rpc_client.hpp"
+
+namespace myrpc {
+namespace client {
+
+// 协程恢复执行的位置；为空时直接在io线程(收到响应的线程)中恢复
+using Executor = std::function<void(std::function<void()>)>;
+
+template <typename T = void>
+class Task;
+
+namespace coro {
+
+// Task的promise公共部分：惰性启动，结束时把执行权交还给等待者(对称转移)
+template <typename T>
+struct PromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto& promise = h.promise();
+            if (promise.detached) {
+                h.destroy();
+                return std::noop_coroutine();
+            }
+            return promise.continuation ? promise.continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+
+    std::coroutine_handle<> continuation;
+    bool detached = false;
+};
+
+template <typename T>
+struct Promise : PromiseBase<T> {
+    Task<T> get_return_object();
+    void return_value(T value) { result.emplace(std::move(value)); }
+    T take() { return std::move(*result); }
+    std::optional<T> result;
+};
+
+template <>
+struct Promise<void> : PromiseBase<void> {
+    Task<void> get_return_object();
+    void return_void() {}
+    void take() {}
+};
+
+}  // namespace coro
+
+// 协程任务：co_await 一个Task会启动它并在它结束后继续执行
+// 顶层任务通过start()启动，任务结束后自行释放
+template <typename T>
+class Task {
+   public:
+    using promise_type = coro::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    explicit Task(handle_type h) : _handle(h) {}
+    Task(Task&& other) noexcept : _handle(other._handle) { other._handle = nullptr; }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (_handle) _handle.destroy();
+    }
+
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        _handle.promise().continuation = continuation;
+        return _handle;
+    }
+    T await_resume() { return _handle.promise().take(); }
+
+    // 在当前线程中开始执行，不等待结果
+    void start() {
+        auto h = _handle;
+        _handle = nullptr;
+        h.promise().detached = true;
+        h.resume();
+    }
+
+   private:
+    handle_type _handle;
+};
+
+namespace coro {
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+}  // namespace coro
+
+// 一次rpc调用的awaitable：挂起协程并发送请求，收到响应后在executor(或io线程)中恢复
+// 回调与await_suspend谁后完成谁负责继续执行协程：回调先完成(命中缓存、连接已断开等同步完成的情况)时不挂起，
+// 协程在当前线程中直接继续，连续的同步完成不会层层嵌套resume
+class RpcAwaitable {
+   public:
+    RpcAwaitable(RpcClient* client, const std::string& method, const Json::Value& params, const Executor& executor)
+        : _client(client), _method(method), _params(params), _executor(executor) {}
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        // 回调可能在await_suspend返回之前就在io线程中执行，交接之后不能再访问成员
+        bool ret = _client->asyncCall(_method, _params, [this, h](RCode rcode, const Json::Value& result) {
+            _result = RpcResult(rcode, result);
+            if (_done.exchange(true) == false) {
+                return;  // await_suspend还未返回，由它决定不挂起
+            }
+            if (_executor) {
+                _executor([h]() { h.resume(); });
+            } else {
+                h.resume();
+            }
+        });
+        if (ret == false) {
+            _result = RpcResult(RCode::RCODE_DISCONNECTED, Json::Value());
+            return false;  // 发送失败，不挂起
+        }
+        return _done.exchange(true) == false;
+    }
+    RpcResult await_resume() { return std::move(_result); }
+
+   private:
+    RpcClient* _client;
+    std::string _method;
+    Json::Value _params;
+    Executor _executor;
+    RpcResult _result;
+    std::atomic<bool> _done{false};
+};
+
+// 支持协程的rpc客户端：auto [rcode, result] = co_await client->call("Add", params);
+// 协程默认在io线程中恢复，恢复后不要再调用同步的call，否则会阻塞io线程导致死锁；
+// 在io线程中co_await时在途窗口已满的调用不会等待，直接以RCODE_OVERLOADED返回
+class CoRpcClient : public RpcClient {
+   public:
+    using ptr = std::shared_ptr<CoRpcClient>;
+    CoRpcClient(const std::string& sip, int sport) : RpcClient(sip, sport) {}
+
+    using RpcClient::call;
+    RpcAwaitable call(const std::string& method, const Json::Value& params) {
+        return RpcAwaitable(this, method, params, _executor);
+    }
+    // 设置协程恢复执行的位置，如线程池的enqueue
+    void setExecutor(const Executor& executor) {
+        _executor = executor;
+    }
+
+   private:
+    Executor _executor;
+};
+
+}  // namespace client
+}  // namespace myrpc
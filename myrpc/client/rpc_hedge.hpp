@@ -0,0 +1,301 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <thread>
+#include "registry_discover.hpp"
+#include "rpc_client.hpp"
+
+namespace myrpc {
+namespace client {
+
+// 方法的调用耗时统计：保留最近windowSize次成功调用的耗时，按需计算分位数
+class LatencyWindow {
+   public:
+    using ptr = std::shared_ptr<LatencyWindow>;
+    void record(int64_t us) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _samples[_next++ % windowSize] = us;
+        _count = std::min(_count + 1, windowSize);
+        _dirty = true;
+    }
+    // 返回q分位的耗时(微秒)，样本不足minSamples时返回-1
+    int64_t percentile(double q) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_count < minSamples) {
+            return -1;
+        }
+        if (_dirty || q != _cached_q) {
+            std::vector<int64_t> sorted(_samples, _samples + _count);
+            size_t k = std::min(_count - 1, (size_t)(q * _count));
+            std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+            _cached = sorted[k];
+            _cached_q = q;
+            _dirty = false;
+        }
+        return _cached;
+    }
+
+   private:
+    static const size_t windowSize = 128;
+    static const size_t minSamples = 20;
+    std::mutex _mutex;
+    int64_t _samples[windowSize];
+    size_t _next = 0;
+    size_t _count = 0;
+    bool _dirty = false;
+    double _cached_q = 0;
+    int64_t _cached = 0;
+};
+
+// 对冲调用的客户端：请求发往服务发现分配的主机，超过对冲延迟仍未收到响应时，向该方法的另一个主机再发一份
+// 先到的成功响应作为结果，另一份请求随即取消；对冲延迟默认取该方法最近调用耗时的p95
+// 只应对幂等的方法使用，同一次调用可能在两台主机上各执行一次
+class HedgedRpcClient : public std::enable_shared_from_this<HedgedRpcClient> {
+   public:
+    using ptr = std::shared_ptr<HedgedRpcClient>;
+    struct Stats {
+        size_t calls = 0;
+        size_t hedged = 0;      // 发出了对冲请求的调用数
+        size_t hedge_wins = 0;  // 对冲请求先返回的调用数
+    };
+    // 后台建立连接需要持有弱引用，因此只能通过create创建
+    static ptr create(const Discoverer::ptr& discoverer) {
+        return ptr(new HedgedRpcClient(discoverer));
+    }
+
+    bool call(const std::string& method, const Json::Value& params, Json::Value& result, int timeout_ms = -1) {
+        Address primary;
+        if (_discoverer->discover(method, primary) == false) {
+            ELOG("服务 %s 没有可用主机", method.c_str());
+            return false;
+        }
+        auto state = std::make_shared<CallState>();
+        auto window = windowOf(method);
+        _calls++;
+        if (send(primary, method, params, timeout_ms, state, 0, window) == false) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        auto hedge_at = std::chrono::steady_clock::now() + std::chrono::microseconds(hedgeDelayUs(window));
+        // 主请求在对冲延迟内结束(成功或失败)时不再等待；失败时立即尝试另一个主机
+        state->cond.wait_until(lock, hedge_at, [&state]() { return state->finished > 0; });
+        if (state->ok == false) {
+            Address alternate;
+            lock.unlock();
+            bool hedge = _discoverer->discoverAlternate(method, excludeOf(primary), alternate) &&
+                         send(alternate, method, params, timeout_ms, state, 1, window);
+            lock.lock();
+            if (hedge) {
+                _hedged++;
+                // 对冲请求发出前主请求可能已经成功
+                if (state->ok) {
+                    Loser loser = takeLoser(state);
+                    lock.unlock();
+                    cancel(loser);
+                    lock.lock();
+                }
+            }
+        }
+        state->cond.wait(lock, [&state]() { return state->ok || state->finished == state->sent; });
+        if (state->ok == false) {
+            ELOG("rpc请求出错：%s", errReason(state->rcode).c_str());
+            return false;
+        }
+        if (state->winner == 1) _hedge_wins++;
+        result.swap(state->result);
+        return true;
+    }
+
+    // 固定的对冲延迟(毫秒)，0表示按方法的p95自动调整
+    void setHedgeDelay(int delay_ms) {
+        _hedge_delay_ms = delay_ms;
+    }
+    // 方法当前的对冲延迟(毫秒)
+    int hedgeDelay(const std::string& method) {
+        return hedgeDelayUs(windowOf(method)) / 1000;
+    }
+    Stats stats() {
+        Stats st;
+        st.calls = _calls.load();
+        st.hedged = _hedged.load();
+        st.hedge_wins = _hedge_wins.load();
+        return st;
+    }
+
+   private:
+    explicit HedgedRpcClient(const Discoverer::ptr& discoverer) : _discoverer(discoverer) {}
+
+    // 一次对冲调用中两份请求的共享状态，0为主请求，1为对冲请求
+    struct CallState {
+        std::mutex mutex;
+        std::condition_variable cond;
+        int sent = 0;
+        int finished = 0;
+        bool ok = false;
+        int winner = -1;
+        RCode rcode = RCode::RCODE_INTERNAL_ERROR;
+        Json::Value result;
+        RpcClient::ptr clients[2];
+        RequestId rids[2] = {0, 0};
+    };
+
+    bool send(const Address& host, const std::string& method, const Json::Value& params, int timeout_ms,
+              const std::shared_ptr<CallState>& state, int index, const LatencyWindow::ptr& window) {
+        // 只有主请求等待连接建立；对冲请求不等待，到新主机的连接建立后的调用才会向它对冲
+        auto cli = clientOf(host, index == 0);
+        if (cli.get() == nullptr) {
+            return false;
+        }
+        // call在等待响应，响应由该客户端的io线程处理，不能在这个线程中发出
+        if (cli->inOwnLoop()) {
+            ELOG("不能在客户端的io线程中同步等待对冲调用的响应！");
+            return false;
+        }
+        auto req = MessageFactory::create<RpcRequest>();
+        req->setMethod(method);
+        req->setParams(params);
+        auto start = std::chrono::steady_clock::now();
+        auto cb = [state, index, start, window](const BaseMessage::ptr& msg) {
+            auto rsp = std::dynamic_pointer_cast<RpcResponse>(msg);
+            RCode rcode = rsp ? rsp->rcode() : RCode::RCODE_INVALID_MSG;
+            if (rcode == RCode::RCODE_OK) {
+                window->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - start).count());
+            }
+            Loser loser;
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                state->finished++;
+                if (state->ok == false) {
+                    if (rcode == RCode::RCODE_OK) {
+                        state->ok = true;
+                        state->winner = index;
+                        state->result = rsp->result();
+                        loser = takeLoser(state);
+                    } else {
+                        state->rcode = rcode;
+                    }
+                }
+                state->cond.notify_all();
+            }
+            cancel(loser);
+        };
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->clients[index] = cli;
+            state->sent++;
+        }
+        if (cli->send(std::dynamic_pointer_cast<BaseMessage>(req), cb, timeout_ms) == false) {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->sent--;
+            state->clients[index].reset();
+            return false;
+        }
+        // 请求id在发送前分配，发送后读取是安全的
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->rids[index] = req->rid();
+        return true;
+    }
+    using Loser = std::pair<RpcClient::ptr, RequestId>;
+    // 取出仍在途的另一份请求，需要持有state->mutex
+    // 取消会在当前线程中以RCODE_CANCELLED执行回调，回调需要加锁，因此取出后在锁外取消
+    static Loser takeLoser(const std::shared_ptr<CallState>& state) {
+        int loser = 1 - state->winner;
+        RequestId rid = state->rids[loser];
+        if (state->clients[loser].get() == nullptr || rid == 0) {
+            return Loser();  // 没有发出或id尚未记录，记录后由调用线程取消
+        }
+        state->rids[loser] = 0;
+        return Loser(state->clients[loser], rid);
+    }
+    static void cancel(const Loser& loser) {
+        if (loser.first) loser.first->cancel(loser.second);
+    }
+
+    int64_t hedgeDelayUs(const LatencyWindow::ptr& window) {
+        int delay_ms = _hedge_delay_ms.load();
+        if (delay_ms > 0) {
+            return delay_ms * 1000;
+        }
+        int64_t p95 = window->percentile(0.95);
+        if (p95 < 0) {
+            return defaultHedgeDelayMs * 1000;
+        }
+        return std::max<int64_t>(p95, minHedgeDelayMs * 1000);
+    }
+    LatencyWindow::ptr windowOf(const std::string& method) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto& window = _windows[method];
+        if (window.get() == nullptr) window = std::make_shared<LatencyWindow>();
+        return window;
+    }
+    // 返回到host的已连接客户端；没有时在后台建立连接，wait为false时返回空，本次不向该主机发送
+    // 后台连接最多等待connectTimeoutMs，连不上的主机在downMs内不再被选为对冲目标
+    RpcClient::ptr clientOf(const Address& host, bool wait) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto it = _clients.find(host);
+        if (it != _clients.end() && it->second->connected()) {
+            return it->second;
+        }
+        if (_connecting.insert(host).second) {
+            ILOG("后台连接主机 %s:%d", host.first.c_str(), host.second);
+            std::weak_ptr<HedgedRpcClient> weak_self = shared_from_this();
+            std::thread([weak_self, host]() {
+                auto cli = std::make_shared<RpcClient>(host.first, host.second, connectTimeoutMs);
+                auto self = weak_self.lock();
+                if (self.get() == nullptr) return;
+                std::unique_lock<std::mutex> lock(self->_mutex);
+                if (cli->connected()) {
+                    self->_clients[host] = cli;
+                } else {
+                    ELOG("连接主机 %s:%d 失败，%dms内不再向它发送对冲请求", host.first.c_str(), host.second, downMs);
+                    self->_clients.erase(host);
+                    self->_down[host] = std::chrono::steady_clock::now() + std::chrono::milliseconds(downMs);
+                }
+                self->_connecting.erase(host);
+                self->_connected.notify_all();
+            }).detach();
+        }
+        // 主请求的连接尚未建立(首次调用或连接已断开)时，等待连接完成或失败
+        if (wait) {
+            _connected.wait(lock, [this, &host]() { return _connecting.count(host) == 0; });
+            it = _clients.find(host);
+            if (it != _clients.end() && it->second->connected()) return it->second;
+        }
+        return RpcClient::ptr();
+    }
+    // 对冲请求不发往的主机：主请求的主机与最近连不上的主机
+    std::set<Address> excludeOf(const Address& primary) {
+        std::set<Address> exclude{primary};
+        auto now = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (auto it = _down.begin(); it != _down.end();) {
+            if (it->second <= now) {
+                it = _down.erase(it);
+            } else {
+                exclude.insert(it->first);
+                ++it;
+            }
+        }
+        return exclude;
+    }
+
+    static const int defaultHedgeDelayMs = 50;  // 样本不足时的对冲延迟
+    static const int minHedgeDelayMs = 1;
+    static constexpr int connectTimeoutMs = 3000;
+    static constexpr int downMs = 5000;
+    Discoverer::ptr _discoverer;
+    std::atomic<int> _hedge_delay_ms{0};
+    std::atomic<size_t> _calls{0};
+    std::atomic<size_t> _hedged{0};
+    std::atomic<size_t> _hedge_wins{0};
+    std::mutex _mutex;
+    std::condition_variable _connected;
+    std::map<Address, RpcClient::ptr> _clients;
+    std::set<Address> _connecting;
+    std::map<Address, std::chrono::steady_clock::time_point> _down;  // 连不上的主机及其恢复可选的时间
+    std::unordered_map<std::string, LatencyWindow::ptr> _windows;
+};
+
+}  // namespace client
+}  // namespace myrpc
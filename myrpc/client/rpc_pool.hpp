@@ -0,0 +1,158 @@
+#pragma once
+#include <thread>
+#include "rpc_client.hpp"
+
+namespace myrpc {
+namespace client {
+
+// 到同一主机的连接池：持有多条RpcClient连接，每次调用选择在途请求最少的连接
+// 断开或连不上的连接在后台线程中按退避间隔重试重建，重建期间请求分摊到其余连接上
+// auto pool = RpcClientPool::create("127.0.0.1", 8080, 8);
+class RpcClientPool : public std::enable_shared_from_this<RpcClientPool> {
+   public:
+    using ptr = std::shared_ptr<RpcClientPool>;
+    // 后台重建需要持有连接池的弱引用，因此只能通过create创建
+    static ptr create(const std::string& sip, int sport, size_t size = defaultPoolSize) {
+        ptr pool(new RpcClientPool(sip, sport, size));
+        for (size_t i = 0; i < pool->_clients.size(); i++) {
+            pool->install(i, std::make_shared<RpcClient>(sip, sport, connectTimeoutMs));
+        }
+        return pool;
+    }
+
+    // 选择在途请求最少的可用连接，没有可用连接时返回空
+    RpcClient::ptr select() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        RpcClient::ptr best;
+        size_t best_in_flight = 0;
+        for (size_t i = 0; i < _clients.size(); i++) {
+            auto& cli = _clients[i];
+            if (cli.get() == nullptr || cli->connected() == false) {
+                replace(i);
+                continue;
+            }
+            size_t in_flight = cli->inFlight();
+            if (best.get() == nullptr || in_flight < best_in_flight) {
+                best = cli;
+                best_in_flight = in_flight;
+            }
+        }
+        return best;
+    }
+
+    bool call(const std::string& method, const Json::Value& params, Json::Value& result, int timeout_ms = -1) {
+        auto cli = select();
+        if (cli.get() == nullptr) {
+            ELOG("%s:%d 没有可用的连接！", _ip.c_str(), _port);
+            return false;
+        }
+        return cli->call(method, params, result, timeout_ms);
+    }
+    template <typename R, typename... Args>
+    std::optional<R> call(const std::string& method, const Args&... args) {
+        auto cli = select();
+        if (cli.get() == nullptr) {
+            ELOG("%s:%d 没有可用的连接！", _ip.c_str(), _port);
+            return std::nullopt;
+        }
+        return cli->call<R>(method, args...);
+    }
+    bool asyncCall(const std::string& method, const Json::Value& params, const RpcCallback& cb, int timeout_ms = -1) {
+        auto cli = select();
+        if (cli.get() == nullptr) {
+            ELOG("%s:%d 没有可用的连接！", _ip.c_str(), _port);
+            return false;
+        }
+        return cli->asyncCall(method, params, cb, timeout_ms);
+    }
+    bool asyncCall(const std::string& method, const Json::Value& params, AsyncRpcResult& result, int timeout_ms = -1) {
+        auto cli = select();
+        if (cli.get() == nullptr) {
+            ELOG("%s:%d 没有可用的连接！", _ip.c_str(), _port);
+            return false;
+        }
+        return cli->asyncCall(method, params, result, timeout_ms);
+    }
+
+    size_t size() {
+        return _clients.size();
+    }
+    // 当前可用的连接数
+    size_t available() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        size_t count = 0;
+        for (auto& cli : _clients) {
+            if (cli && cli->connected()) count++;
+        }
+        return count;
+    }
+
+   private:
+    RpcClientPool(const std::string& sip, int sport, size_t size)
+        : _ip(sip), _port(sport), _clients(size == 0 ? 1 : size), _replacing(_clients.size(), false) {}
+
+    // 在后台线程中重建第i条连接：每次连接最多等待connectTimeoutMs，失败后按指数退避重试，连接池释放后停止
+    // 需要持有_mutex
+    void replace(size_t i) {
+        if (_replacing[i]) {
+            return;
+        }
+        _replacing[i] = true;
+        ILOG("%s:%d 第 %zu 条连接不可用，后台重建", _ip.c_str(), _port, i);
+        std::weak_ptr<RpcClientPool> weak_pool = shared_from_this();
+        std::thread([weak_pool, i, ip = _ip, port = _port]() {
+            int backoff_ms = minBackoffMs;
+            while (true) {
+                auto cli = std::make_shared<RpcClient>(ip, port, connectTimeoutMs);
+                auto pool = weak_pool.lock();
+                if (pool.get() == nullptr) {
+                    return;
+                }
+                if (cli->connected()) {
+                    return pool->install(i, cli);
+                }
+                pool.reset();
+                ELOG("%s:%d 第 %zu 条连接重建失败，%dms后重试", ip.c_str(), port, i, backoff_ms);
+                std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                backoff_ms = std::min(backoff_ms * 2, maxBackoffMs);
+            }
+        }).detach();
+    }
+    void install(size_t i, const RpcClient::ptr& cli) {
+        // 连接断开时立即开始重建，不必等到下一次select
+        // 被替换掉的旧连接在释放时也会触发断开回调，只处理仍在池中的连接
+        std::weak_ptr<RpcClientPool> weak_pool = shared_from_this();
+        RpcClient* raw = cli.get();
+        cli->setCloseCallback([weak_pool, i, raw](const BaseConnection::ptr&) {
+            auto pool = weak_pool.lock();
+            if (pool) {
+                std::unique_lock<std::mutex> lock(pool->_mutex);
+                if (pool->_clients[i].get() == raw) pool->replace(i);
+            }
+        });
+        RpcClient::ptr old;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            old.swap(_clients[i]);
+            _clients[i] = cli;
+            _replacing[i] = false;
+            // 设置回调之前连接就已断开(或没有连上)时断开回调不会再触发，在这里补上重建
+            // connected()先于断开回调更新，两处都发现断开时由_replacing去重
+            if (cli->connected() == false) replace(i);
+        }
+        // 旧连接在锁外释放
+    }
+
+    static const size_t defaultPoolSize = 4;
+    static constexpr int connectTimeoutMs = 3000;
+    static constexpr int minBackoffMs = 100;
+    static constexpr int maxBackoffMs = 5000;
+    std::string _ip;
+    int _port;
+    std::mutex _mutex;
+    std::vector<RpcClient::ptr> _clients;
+    std::vector<bool> _replacing;  // 第i条连接是否正在后台重建
+};
+
+}  // namespace client
+}  // namespace myrpc
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <memory>
 #include <functional>
 #include "fields.hpp"
@@ -8,22 +9,32 @@ namespace myrpc {
     class BaseMessage {
         public:
             using ptr = std::shared_ptr<BaseMessage>;
-			BaseMessage() : _rid(UUID::uuid()) {}
+			BaseMessage() : _rid(0) {}
             virtual ~BaseMessage(){}
-            virtual std::string rid() { return _rid; }
-			virtual void setId(const std::string &id) {
+            // 请求id由发送方按连接递增分配，响应沿用请求的id
+            virtual RequestId rid() { return _rid; }
+			virtual void setId(RequestId id) {
 				_rid = id;
 			}
             virtual void setMType(MType mtype) {
 				_mtype = mtype;
             }
             virtual MType mtype() { return _mtype; }
-            virtual std::string serialize() = 0;
-            virtual bool unserialize(const std::string &msg) = 0;
+            virtual std::string serialize(CodecType codec) = 0;
+            virtual bool unserialize(const std::string &msg, CodecType codec) {
+				return unserialize(msg.data(), msg.size(), codec);
+			}
+            // 直接从外部内存(如网络缓冲区)中反序列化，避免先拷贝成string
+            virtual bool unserialize(const char *data, size_t len, CodecType codec) = 0;
+            // 直接编码为完整的帧：head向字符串追加协议的帧头，帧头与正文中不变的部分可以在多次发送间缓存
+            // 帧头中的长度与id由协议补写；返回false表示不支持，协议按serialize编码正文后再组帧
+            virtual bool encodeFrame(CodecType codec, const std::function<void(std::string &)> &head, std::string &frame) {
+                return false;
+            }
             virtual bool check() = 0;
 		protected:
             MType _mtype;
-            std::string _rid;
+            RequestId _rid;
     };
 
     class BaseBuffer {
@@ -34,6 +45,13 @@ namespace myrpc {
             virtual void retrieveInt32() = 0;
             virtual int32_t readInt32() = 0;
             virtual std::string retrieveAsString(size_t len) = 0;
+            // 返回可读数据的起始地址，不移动读指针；数据在retrieve之前一直有效
+            virtual const char *peek() = 0;
+            virtual void retrieve(size_t len) = 0;
+            // 写入接口，用于将消息直接序列化到发送缓冲区中
+            virtual void appendInt32(int32_t val) = 0;
+            virtual void appendInt64(int64_t val) = 0;
+            virtual void append(const char *data, size_t len) = 0;
     };
 
     class BaseProtocol {
@@ -42,16 +60,40 @@ namespace myrpc {
             virtual bool canProcessed(const BaseBuffer::ptr &buf) = 0;
             virtual bool onMessage(const BaseBuffer::ptr &buf, BaseMessage::ptr &msg) = 0;
             virtual std::string serialize(const BaseMessage::ptr &msg) = 0;
+            // 将消息直接追加到缓冲区中，省去中间字符串的拼接与拷贝
+            virtual void serialize(const BaseMessage::ptr &msg, BaseBuffer &out) = 0;
+            virtual void setCodec(CodecType codec) = 0;
+            virtual void setCompressThreshold(size_t threshold) = 0;
+            virtual void setMaxMessageSize(size_t size) = 0;
+            // 本端可以接收的能力集合，握手时发送给对端
+            virtual uint32_t capabilities() = 0;
+            // 握手完成后设置双方共同支持的能力，此后按协商结果选择编码、压缩与分片
+            virtual void setPeerCapabilities(uint32_t caps) = 0;
+            // 握手已完成且对端确认支持cap；未握手时返回false
+            virtual bool negotiated(uint32_t cap) = 0;
+            // 以当前配置创建一个新的协议对象，每条连接各自持有一份
+            virtual ptr clone() = 0;
     };
 
     class BaseConnection {
         public:
             using ptr = std::shared_ptr<BaseConnection>;
+            BaseConnection() : _id(nextId()) {}
+            // 进程内唯一的连接编号：连接对象释放后地址可能被新连接复用，按连接索引的状态应使用编号
+            uint64_t id() const { return _id; }
             virtual void send(const BaseMessage::ptr &msg) = 0;
             virtual void sendInLoop(const BaseMessage::ptr &msg) = 0;
             virtual void shutdown() = 0;
             virtual bool connected() = 0;
 			virtual Address getHost() = 0;
+            virtual BaseProtocol::ptr protocol() = 0;
+
+        private:
+            static uint64_t nextId() {
+                static std::atomic<uint64_t> seq{0};
+                return seq.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+            uint64_t _id;
     };
 
     using ConnectionCallback = std::function<void(const BaseConnection::ptr&)>;
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace myrpc {
+
+// LZ4 块格式(block format)的精简实现，与liblz4的LZ4_decompress_safe互相兼容
+// 只使用单个哈希表做贪心匹配，压缩率略低于官方实现，但足够快且没有外部依赖
+// |--token--|--literal len ext--|--literals--|--offset(2)--|--match len ext--|...
+class LZ4 {
+   public:
+    // 压缩结果追加到out末尾
+    static void compress(const char* src, size_t len, std::string& out) {
+        uint32_t table[1 << hashLog];
+        memset(table, 0, sizeof(table));
+        out.reserve(out.size() + len + len / 255 + 16);
+        size_t anchor = 0;
+        if (len > mfLimit) {
+            // 最后一个匹配必须在 len-mfLimit 之前开始，且距离结尾至少保留lastLiterals个字面量
+            size_t ip = 0;
+            size_t limit = len - mfLimit;
+            size_t match_end = len - lastLiterals;
+            while (ip < limit) {
+                uint32_t seq = read32(src + ip);
+                uint32_t& slot = table[hash(seq)];
+                size_t ref = slot;
+                slot = (uint32_t)ip;
+                if (ref >= ip || ip - ref > maxOffset || read32(src + ref) != seq) {
+                    ip++;
+                    continue;
+                }
+                size_t mlen = minMatch;
+                while (ip + mlen < match_end && src[ref + mlen] == src[ip + mlen]) mlen++;
+                emit(src + anchor, ip - anchor, ip - ref, mlen, out);
+                ip += mlen;
+                anchor = ip;
+            }
+        }
+        emit(src + anchor, len - anchor, 0, 0, out);
+    }
+
+    // 解压到dst，要求解压后的长度恰好为dst_len
+    static bool decompress(const char* src, size_t len, char* dst, size_t dst_len) {
+        const uint8_t* ip = (const uint8_t*)src;
+        const uint8_t* iend = ip + len;
+        size_t op = 0;
+        while (ip < iend) {
+            uint8_t token = *ip++;
+            size_t lit_len = token >> 4;
+            if (lit_len == 15 && readLength(ip, iend, lit_len) == false) return false;
+            if ((size_t)(iend - ip) < lit_len || dst_len - op < lit_len) return false;
+            memcpy(dst + op, ip, lit_len);
+            ip += lit_len;
+            op += lit_len;
+            if (ip == iend) break;  // 最后一个序列只有字面量
+            if (iend - ip < 2) return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > op) return false;
+            size_t mlen = token & 15;
+            if (mlen == 15 && readLength(ip, iend, mlen) == false) return false;
+            mlen += minMatch;
+            if (dst_len - op < mlen) return false;
+            // 匹配区间可能与输出区间重叠，只能逐字节拷贝
+            for (size_t i = 0; i < mlen; i++, op++) dst[op] = dst[op - offset];
+        }
+        return op == dst_len;
+    }
+
+   private:
+    static const int hashLog = 12;
+    static const size_t minMatch = 4;
+    static const size_t lastLiterals = 5;
+    static const size_t mfLimit = 12;
+    static const size_t maxOffset = 65535;
+
+    static uint32_t read32(const char* p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static uint32_t hash(uint32_t seq) {
+        return (seq * 2654435761U) >> (32 - hashLog);
+    }
+    static void writeLength(size_t len, std::string& out) {
+        for (; len >= 255; len -= 255) out.push_back((char)255);
+        out.push_back((char)len);
+    }
+    static bool readLength(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+        uint8_t byte;
+        do {
+            if (ip >= iend) return false;
+            byte = *ip++;
+            len += byte;
+        } while (byte == 255);
+        return true;
+    }
+    // 输出一个序列，mlen为0时表示最后一个只有字面量的序列
+    static void emit(const char* lit, size_t lit_len, size_t offset, size_t mlen, std::string& out) {
+        size_t token_pos = out.size();
+        uint8_t token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+        out.push_back(0);
+        if (lit_len >= 15) writeLength(lit_len - 15, out);
+        out.append(lit, lit_len);
+        if (mlen != 0) {
+            out.push_back((char)(offset & 0xff));
+            out.push_back((char)(offset >> 8));
+            size_t ml = mlen - minMatch;
+            token |= (uint8_t)(ml < 15 ? ml : 15);
+            if (ml >= 15) writeLength(ml - 15, out);
+        }
+        out[token_pos] = (char)token;
+    }
+};
+
+}  // namespace myrpc
@@ -4,6 +4,7 @@
 #include <time.h>
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -63,11 +64,33 @@ class JSON {
         return ss.str();
     }
 
+    // 以紧凑格式(无缩进与换行)追加到body末尾，用于拼接预编码的正文
+    static bool append(const Json::Value& val, std::string& body) {
+        // 写入器与输出流按线程复用，避免每次创建
+        static thread_local std::unique_ptr<Json::StreamWriter> sw = []() {
+            Json::StreamWriterBuilder swb;
+            swb["indentation"] = "";
+            return std::unique_ptr<Json::StreamWriter>(swb.newStreamWriter());
+        }();
+        static thread_local std::ostringstream ss;
+        ss.str("");
+        ss.clear();
+        if (sw->write(val, &ss) != 0) {
+            ELOG("serialize json failed");
+            return false;
+        }
+        body += ss.str();
+        return true;
+    }
+
     static bool unserialize(const std::string& body, Json::Value& val) {
+        return unserialize(body.data(), body.size(), val);
+    }
+    static bool unserialize(const char* data, size_t len, Json::Value& val) {
         Json::CharReaderBuilder crb;
         std::unique_ptr<Json::CharReader> cr(crb.newCharReader());
         std::string errs;
-        int ret = cr->parse(body.c_str(), body.c_str() + body.size(), &val, &errs);
+        int ret = cr->parse(data, data + len, &val, &errs);
         if (ret == false) {
             ELOG("unserialize json failed: %s", errs.c_str());
             return false;
@@ -76,6 +99,197 @@ class JSON {
     }
 };
 
+// 紧凑的TLV二进制编码，与JSON类的接口保持一致
+// |--tag(1)--|--value--|
+// 整数使用zigzag+varint，字符串/数组/对象先写varint长度(元素个数)，浮点数按大端写8字节
+class BINARY {
+   public:
+    enum Tag : uint8_t {
+        TAG_NULL = 0,
+        TAG_FALSE,
+        TAG_TRUE,
+        TAG_INT,
+        TAG_UINT,
+        TAG_DOUBLE,
+        TAG_STRING,
+        TAG_ARRAY,
+        TAG_OBJECT
+    };
+
+    static bool serialize(const Json::Value& val, std::string& body) {
+        body.clear();
+        encode(val, body);
+        return true;
+    }
+    static std::string serialize(const Json::Value& val) {
+        std::string body;
+        encode(val, body);
+        return body;
+    }
+
+    static bool unserialize(const std::string& body, Json::Value& val) {
+        return unserialize(body.data(), body.size(), val);
+    }
+    static bool unserialize(const char* data, size_t len, Json::Value& val) {
+        const char* cur = data;
+        const char* end = data + len;
+        if (decode(cur, end, val, 0) == false || cur != end) {
+            ELOG("unserialize binary failed");
+            return false;
+        }
+        return true;
+    }
+
+    // 增量编码接口，用于拼接预编码的正文：对象头(成员个数)之后依次写入成员名与成员值
+    static void appendObjectHead(size_t count, std::string& out) {
+        out.push_back(TAG_OBJECT);
+        putVarint(count, out);
+    }
+    static void appendKey(const std::string& key, std::string& out) {
+        putString(key.data(), key.size(), out);
+    }
+    static void append(const Json::Value& val, std::string& out) {
+        encode(val, out);
+    }
+
+   private:
+    static const int maxDepth = 64;
+
+    static void putVarint(uint64_t v, std::string& out) {
+        while (v >= 0x80) {
+            out.push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((char)v);
+    }
+    static bool getVarint(const char*& cur, const char* end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && cur < end; shift += 7) {
+            uint8_t byte = (uint8_t)*cur++;
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+    static void putString(const char* str, size_t len, std::string& out) {
+        putVarint(len, out);
+        out.append(str, len);
+    }
+    static bool getLength(const char*& cur, const char* end, uint64_t& len) {
+        // 长度不可能超过剩余的字节数，提前拦截恶意长度，避免超大的resize
+        return getVarint(cur, end, len) && len <= (uint64_t)(end - cur);
+    }
+
+    static void encode(const Json::Value& val, std::string& out) {
+        switch (val.type()) {
+            case Json::nullValue:
+                out.push_back(TAG_NULL);
+                break;
+            case Json::booleanValue:
+                out.push_back(val.asBool() ? TAG_TRUE : TAG_FALSE);
+                break;
+            case Json::intValue: {
+                int64_t v = val.asInt64();
+                out.push_back(TAG_INT);
+                putVarint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63), out);
+                break;
+            }
+            case Json::uintValue:
+                out.push_back(TAG_UINT);
+                putVarint(val.asUInt64(), out);
+                break;
+            case Json::realValue: {
+                double d = val.asDouble();
+                uint64_t bits;
+                memcpy(&bits, &d, sizeof(bits));
+                out.push_back(TAG_DOUBLE);
+                for (int i = 7; i >= 0; i--) out.push_back((char)(bits >> (i * 8)));
+                break;
+            }
+            case Json::stringValue: {
+                const char* begin = nullptr;
+                const char* end = nullptr;
+                val.getString(&begin, &end);
+                out.push_back(TAG_STRING);
+                putString(begin, end - begin, out);
+                break;
+            }
+            case Json::arrayValue:
+                out.push_back(TAG_ARRAY);
+                putVarint(val.size(), out);
+                for (Json::ArrayIndex i = 0; i < val.size(); i++) encode(val[i], out);
+                break;
+            case Json::objectValue:
+                out.push_back(TAG_OBJECT);
+                putVarint(val.size(), out);
+                for (auto it = val.begin(); it != val.end(); ++it) {
+                    const char* kend = nullptr;
+                    const char* kbegin = it.memberName(&kend);
+                    putString(kbegin, kend - kbegin, out);
+                    encode(*it, out);
+                }
+                break;
+        }
+    }
+
+    static bool decode(const char*& cur, const char* end, Json::Value& val, int depth) {
+        if (cur >= end || depth > maxDepth) return false;
+        uint8_t tag = (uint8_t)*cur++;
+        uint64_t num = 0;
+        switch (tag) {
+            case TAG_NULL:
+                val = Json::Value();
+                return true;
+            case TAG_FALSE:
+            case TAG_TRUE:
+                val = (tag == TAG_TRUE);
+                return true;
+            case TAG_INT:
+                if (getVarint(cur, end, num) == false) return false;
+                val = (Json::Int64)((num >> 1) ^ (~(num & 1) + 1));
+                return true;
+            case TAG_UINT:
+                if (getVarint(cur, end, num) == false) return false;
+                val = (Json::UInt64)num;
+                return true;
+            case TAG_DOUBLE: {
+                if (end - cur < 8) return false;
+                for (int i = 0; i < 8; i++) num = (num << 8) | (uint8_t)*cur++;
+                double d;
+                memcpy(&d, &num, sizeof(d));
+                val = d;
+                return true;
+            }
+            case TAG_STRING:
+                if (getLength(cur, end, num) == false) return false;
+                val = Json::Value(cur, cur + num);
+                cur += num;
+                return true;
+            case TAG_ARRAY:
+                // 每个元素至少占1字节
+                if (getLength(cur, end, num) == false) return false;
+                val = Json::Value(Json::arrayValue);
+                val.resize((Json::ArrayIndex)num);
+                for (Json::ArrayIndex i = 0; i < num; i++) {
+                    if (decode(cur, end, val[i], depth + 1) == false) return false;
+                }
+                return true;
+            case TAG_OBJECT:
+                if (getLength(cur, end, num) == false) return false;
+                val = Json::Value(Json::objectValue);
+                for (uint64_t i = 0; i < num; i++) {
+                    uint64_t klen = 0;
+                    if (getLength(cur, end, klen) == false) return false;
+                    Json::Value& member = val[std::string(cur, klen)];
+                    cur += klen;
+                    if (decode(cur, end, member, depth + 1) == false) return false;
+                }
+                return true;
+        }
+        return false;
+    }
+};
+
 class UUID {
    public:
     static std::string uuid() {
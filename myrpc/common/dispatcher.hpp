@@ -23,7 +23,7 @@ class Dispatcher {
 	}
 
     void onMessage(const BaseConnection::ptr& conn, BaseMessage::ptr& msg) {
-		//DLOG("dispatcher收到消息，rid=%s", msg->rid().c_str());
+		//DLOG("dispatcher收到消息，rid=%lu", msg->rid());
 		myrpc::MessageCallback* callback = nullptr;
 		{
 			std::unique_lock<std::mutex> lock(_mutex);
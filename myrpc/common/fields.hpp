@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -6,6 +7,7 @@
 namespace myrpc {
 
 typedef std::pair<std::string, int> Address;
+typedef uint64_t RequestId;
 
 struct AddrHash {
     size_t operator()(const Address& a) const {
@@ -20,17 +22,26 @@ const int INF = 0x3f3f3f3f;
 #define KEY_OPTYPE "optype"
 #define KEY_IDLE_COUNT "idle_count"
 #define KEY_HOST "host"
+#define KEY_HOSTS "hosts"
 #define KEY_HOST_IP "ip"
 #define KEY_HOST_PORT "port"
 #define KEY_RCODE "rcode"
 #define KEY_RESULT "result"
+#define KEY_VERSION "version"
+#define KEY_CAPS "capabilities"
+#define KEY_CALLS "calls"
+#define KEY_RESULTS "results"
+#define KEY_TIMEOUT "timeout"
 
 enum class MType {
     REQ_RPC = 0,
     RSP_RPC,
 	RSP_CONNECT,
     REQ_SERVICE,
-    RSP_SERVICE
+    RSP_SERVICE,
+    REQ_RPC_BATCH,
+    RSP_RPC_BATCH,
+    REQ_CANCEL  // 取消请求，帧中的id为要取消的请求id，没有响应
 };
 
 enum class RCode {
@@ -45,7 +56,10 @@ enum class RCode {
     RCODE_INVALID_OPTYPE,
 	RCODE_DUPLICATE_REGISTRY,
 	RCODE_HEARTBEAT_WRONG,
-    RCODE_INTERNAL_ERROR
+    RCODE_INTERNAL_ERROR,
+    RCODE_TIMEOUT,  // 新的状态码追加在末尾，保持已有状态码的取值不变
+    RCODE_CANCELLED,
+    RCODE_OVERLOADED  // 服务端排队已满，请求未被处理，可以稍后重试或换一个主机
 };
 static std::string errReason(RCode code) {
     static std::vector<std::string> err_map = {
@@ -60,8 +74,11 @@ static std::string errReason(RCode code) {
         "无效的操作类型",
 		"重复注册服务！",
 		"心跳检测失败！",
-        "内部错误！"};
-    if (code < RCode::RCODE_OK || code > RCode::RCODE_INTERNAL_ERROR)
+        "内部错误！",
+        "请求超时！",
+        "请求已取消！",
+        "服务过载！"};
+    if (code < RCode::RCODE_OK || (size_t)code >= err_map.size())
         return "未知错误！";
     else
         return err_map[(int)code];
@@ -69,7 +86,14 @@ static std::string errReason(RCode code) {
 
 enum class RType {
     REQ_ASYNC = 0,
-    REQ_CALLBACK
+    REQ_CALLBACK,
+    REQ_SYNC
+};
+
+// 消息正文的编码方式
+enum class CodecType {
+    JSON = 0,  // jsoncpp 文本格式
+    BINARY     // 紧凑的TLV二进制格式
 };
 
 
@@ -82,6 +106,19 @@ enum class ServiceOptype {
     SERVICE_OFFLINE,
 	SERVICE_RETURN,
 	SERVICE_UPDATE,
-    SERVICE_UNKNOW
+    SERVICE_UNKNOW,
+	// 以下为后来加入的操作类型，追加在末尾，保持已有操作类型在线路上的取值不变
+	SERVICE_HANDSHAKE,
+	SERVICE_PROVIDERS  // 查询方法当前所有可用的主机，不分配主机，也不影响主机的空闲量
+};
+
+// 连接握手时协商的协议版本与可选能力
+const int PROTOCOL_VERSION = 1;
+enum Capability : uint32_t {
+    CAP_BINARY_BODY = 1 << 0,  // 可以接收BINARY编码的正文
+    CAP_COMPRESS = 1 << 1,     // 可以接收LZ4压缩的正文
+    CAP_CHUNK = 1 << 2,        // 可以接收分片帧
+    CAP_BATCH = 1 << 3,        // 可以处理批量调用帧
+    CAP_CANCEL = 1 << 4        // 可以处理取消帧
 };
 }  // namespace myrpc
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include <mutex>
 #include "abstract.hpp"
 #include "detail.hpp"
 #include "fields.hpp"
@@ -7,16 +8,25 @@ namespace myrpc {
 class JsonMessage : public BaseMessage {
    public:
     using ptr = std::shared_ptr<JsonMessage>;
-    virtual std::string serialize() override {
+    virtual std::string serialize(CodecType codec) override {
         std::string body;
-        bool ret = JSON::serialize(_body, body);
+        bool ret = false;
+        if (codec == CodecType::BINARY) {
+            ret = BINARY::serialize(_body, body);
+        } else {
+            ret = JSON::serialize(_body, body);
+        }
         if (ret == false) {
             return std::string();
         }
         return body;
     }
-    virtual bool unserialize(const std::string& msg) override {
-        return JSON::unserialize(msg, _body);
+    using BaseMessage::unserialize;
+    virtual bool unserialize(const char* data, size_t len, CodecType codec) override {
+        if (codec == CodecType::BINARY) {
+            return BINARY::unserialize(data, len, _body);
+        }
+        return JSON::unserialize(data, len, _body);
     }
 
    protected:
@@ -26,6 +36,16 @@ class JsonMessage : public BaseMessage {
 class JsonRequest : public JsonMessage {
    public:
     using ptr = std::shared_ptr<JsonRequest>;
+    // 调用方等待响应的时长(毫秒)，0表示不限时；服务端据此丢弃排队过久、调用方已不再等待的请求
+    int timeout() {
+        // 通过const引用查找，避免operator[]在没有超时字段的正文中插入空成员
+        const Json::Value& body = _body;
+        const Json::Value* timeout_ms = body.isObject() ? body.find(KEY_TIMEOUT, KEY_TIMEOUT + sizeof(KEY_TIMEOUT) - 1) : nullptr;
+        return timeout_ms && timeout_ms->isIntegral() ? timeout_ms->asInt() : 0;
+    }
+    void setTimeout(int timeout_ms) {
+        _body[KEY_TIMEOUT] = timeout_ms;
+    }
 };
 class JsonResponse : public JsonMessage {
    public:
@@ -64,14 +84,16 @@ class RpcRequest : public JsonRequest {
             ELOG("RPC请求中没有方法名称或方法名称类型错误！");
             return false;
         }
+        // 参数可以是按字段名组织的对象，也可以是按位置组织的数组
         if (_body[KEY_PARAMS].isNull() == true ||
-            _body[KEY_PARAMS].isObject() == false) {
+            (_body[KEY_PARAMS].isObject() == false && _body[KEY_PARAMS].isArray() == false)) {
             ELOG("RPC请求中没有参数信息或参数信息类型错误！");
             return false;
         }
         return true;
     }
-    std::string method() {
+    // 预编码的请求不在正文中保存方法名，需要通过虚函数获取
+    virtual std::string method() {
         return _body[KEY_METHOD].asString();
     }
     void setMethod(const std::string& method_name) {
@@ -85,6 +107,101 @@ class RpcRequest : public JsonRequest {
     }
 };
 
+// 预编码的rpc请求：方法名部分按各编码方式预先编码，在同一方法的多次调用间共享
+// 正文中只保存参数与超时，序列化时只编码这两部分，再与预编码的前缀拼接
+// 发送时帧头也一起缓存：帧前缀(帧头+正文的不变部分)只拷贝一次，之后直接追加参数，不再经过中间的正文字符串
+class PreparedRpcRequest : public RpcRequest {
+   public:
+    using ptr = std::shared_ptr<PreparedRpcRequest>;
+    // 与参数无关的不变部分
+    struct Header {
+        using ptr = std::shared_ptr<const Header>;
+        std::string method;
+        std::string json;    // {"method":"xxx","parameters":
+        std::string binary;  // 方法名成员与参数成员名
+        // 帧前缀按JSON、BINARY(无超时)、BINARY(带超时)分别缓存，第一次以该方式发送时生成
+        // BINARY正文以成员数开头，带不带超时的前缀不同
+        mutable std::once_flag frame_once[3];
+        mutable std::string frame[3];
+    };
+    static Header::ptr prepare(const std::string& method) {
+        auto header = std::make_shared<Header>();
+        header->method = method;
+        header->json = "{";
+        JSON::append(Json::Value(KEY_METHOD), header->json);
+        header->json += ":";
+        JSON::append(Json::Value(method), header->json);
+        header->json += ",";
+        JSON::append(Json::Value(KEY_PARAMS), header->json);
+        header->json += ":";
+        BINARY::appendKey(KEY_METHOD, header->binary);
+        BINARY::append(Json::Value(method), header->binary);
+        BINARY::appendKey(KEY_PARAMS, header->binary);
+        return header;
+    }
+
+    explicit PreparedRpcRequest(const Header::ptr& header) : _header(header) {}
+    virtual std::string serialize(CodecType codec) override {
+        std::string body;
+        body.reserve(_header->json.size() + 32);
+        appendPrefix(codec, body);
+        if (appendTail(codec, body) == false) {
+            return std::string();
+        }
+        return body;
+    }
+    virtual bool encodeFrame(CodecType codec, const std::function<void(std::string&)>& head, std::string& frame) override {
+        size_t index = codec == CodecType::JSON ? 0 : (timeout() > 0 ? 2 : 1);
+        std::call_once(_header->frame_once[index], [&]() {
+            std::string& prefix = _header->frame[index];
+            head(prefix);
+            appendPrefix(codec, prefix);
+        });
+        const std::string& prefix = _header->frame[index];
+        frame.reserve(prefix.size() + 32);
+        frame = prefix;
+        return appendTail(codec, frame);
+    }
+    // 方法名不在正文中
+    virtual std::string method() override {
+        return _header->method;
+    }
+
+   private:
+    // 正文中与参数无关的部分
+    void appendPrefix(CodecType codec, std::string& body) {
+        if (codec == CodecType::BINARY) {
+            BINARY::appendObjectHead(timeout() > 0 ? 3 : 2, body);
+            body += _header->binary;
+            return;
+        }
+        body += _header->json;
+    }
+    // 参数与超时
+    bool appendTail(CodecType codec, std::string& body) {
+        const Json::Value& params = _body[KEY_PARAMS];
+        int timeout_ms = timeout();
+        if (codec == CodecType::BINARY) {
+            BINARY::append(params, body);
+            if (timeout_ms > 0) {
+                BINARY::appendKey(KEY_TIMEOUT, body);
+                BINARY::append(Json::Value(timeout_ms), body);
+            }
+            return true;
+        }
+        if (JSON::append(params, body) == false) {
+            return false;
+        }
+        if (timeout_ms > 0) {
+            body += ",\"" KEY_TIMEOUT "\":";
+            body += std::to_string(timeout_ms);
+        }
+        body += "}";
+        return true;
+    }
+
+    Header::ptr _header;
+};
 
 class ServiceRequest : public JsonRequest {
    public:
@@ -105,6 +222,8 @@ class ServiceRequest : public JsonRequest {
             return false;
         }
         if (_body[KEY_OPTYPE].asInt() != (int)(ServiceOptype::SERVICE_DISCOVERY) &&
+            _body[KEY_OPTYPE].asInt() != (int)(ServiceOptype::SERVICE_HANDSHAKE) &&
+            _body[KEY_OPTYPE].asInt() != (int)(ServiceOptype::SERVICE_PROVIDERS) &&
             (_body[KEY_HOST].isNull() == true ||
              _body[KEY_HOST].isObject() == false ||
              _body[KEY_HOST][KEY_HOST_IP].isNull() == true ||
@@ -141,9 +260,54 @@ class ServiceRequest : public JsonRequest {
         val[KEY_HOST_PORT] = host.second;
         _body[KEY_HOST] = val;
     }
+    int version() {
+        return _body[KEY_VERSION].asInt();
+    }
+    void setVersion(int version) {
+        _body[KEY_VERSION] = version;
+    }
+    uint32_t capabilities() {
+        return _body[KEY_CAPS].asUInt();
+    }
+    void setCapabilities(uint32_t caps) {
+        _body[KEY_CAPS] = caps;
+    }
+};
+
+// 批量rpc请求：calls为数组，每个元素包含方法名称与参数，与RpcRequest的字段一致
+class BatchRequest : public JsonRequest {
+   public:
+    using ptr = std::shared_ptr<BatchRequest>;
+	BatchRequest() {
+		_mtype = MType::REQ_RPC_BATCH;
+	}
+    virtual bool check() override {
+        if (_body[KEY_CALLS].isArray() == false) {
+            ELOG("批量请求中没有调用列表或调用列表类型错误！");
+            return false;
+        }
+        for (auto& call : _body[KEY_CALLS]) {
+            if (call.isObject() == false || call[KEY_METHOD].isString() == false ||
+                (call[KEY_PARAMS].isObject() == false && call[KEY_PARAMS].isArray() == false)) {
+                ELOG("批量请求中的调用信息格式错误！");
+                return false;
+            }
+        }
+        return true;
+    }
+    const Json::Value& calls() {
+        return _body[KEY_CALLS];
+    }
+    void addCall(const std::string& method_name, const Json::Value& params) {
+        Json::Value call;
+        call[KEY_METHOD] = method_name;
+        call[KEY_PARAMS] = params;
+        _body[KEY_CALLS].append(std::move(call));
+    }
 };
 
 class RpcResponse : public JsonResponse {
+
    public:
     using ptr = std::shared_ptr<RpcResponse>;
 	RpcResponse() {
@@ -229,6 +393,82 @@ class ServiceResponse : public JsonResponse {
     Address host() {
 		return std::make_pair(_body[KEY_HOST][KEY_HOST_IP].asString(), _body[KEY_HOST][KEY_HOST_PORT].asInt());
 	}
+    // SERVICE_PROVIDERS响应中方法的所有可用主机
+    void setHosts(const std::vector<Address>& hosts) {
+        Json::Value val(Json::arrayValue);
+        for (auto& host : hosts) {
+            Json::Value item;
+            item[KEY_HOST_IP] = host.first;
+            item[KEY_HOST_PORT] = host.second;
+            val.append(item);
+        }
+        _body[KEY_HOSTS] = val;
+    }
+    std::vector<Address> hosts() {
+        std::vector<Address> hosts;
+        const Json::Value& val = _body[KEY_HOSTS];
+        for (Json::ArrayIndex i = 0; val.isArray() && i < val.size(); i++) {
+            hosts.emplace_back(val[i][KEY_HOST_IP].asString(), val[i][KEY_HOST_PORT].asInt());
+        }
+        return hosts;
+    }
+    int version() {
+        return _body[KEY_VERSION].asInt();
+    }
+    void setVersion(int version) {
+        _body[KEY_VERSION] = version;
+    }
+    uint32_t capabilities() {
+        return _body[KEY_CAPS].asUInt();
+    }
+    void setCapabilities(uint32_t caps) {
+        _body[KEY_CAPS] = caps;
+    }
+};
+
+// 取消请求：id与要取消的请求相同，正文为空
+class CancelRequest : public JsonRequest {
+   public:
+    using ptr = std::shared_ptr<CancelRequest>;
+	CancelRequest() {
+		_mtype = MType::REQ_CANCEL;
+	}
+    virtual bool check() override {
+        return true;
+    }
+};
+
+// 批量rpc响应：results与请求中的calls一一对应，每个元素包含各自的状态码与结果
+class BatchResponse : public JsonResponse {
+   public:
+    using ptr = std::shared_ptr<BatchResponse>;
+	BatchResponse() {
+		_mtype = MType::RSP_RPC_BATCH;
+	}
+    virtual bool check() override {
+        if (_body[KEY_RCODE].isNull() == true ||
+            _body[KEY_RCODE].isIntegral() == false) {
+            ELOG("响应中没有响应状态码,或状态码类型错误！");
+            return false;
+        }
+        if (_body[KEY_RESULTS].isArray() == false) {
+            ELOG("批量响应中没有结果列表,或结果列表类型错误！");
+            return false;
+        }
+        for (auto& item : _body[KEY_RESULTS]) {
+            if (item.isObject() == false || item[KEY_RCODE].isIntegral() == false) {
+                ELOG("批量响应中的结果信息格式错误！");
+                return false;
+            }
+        }
+        return true;
+    }
+    const Json::Value& results() {
+        return _body[KEY_RESULTS];
+    }
+    void setResults(Json::Value&& results) {
+        _body[KEY_RESULTS] = std::move(results);
+    }
 };
 
 // 实现一个消息对象的生产工厂
@@ -246,6 +486,12 @@ class MessageFactory {
                 return std::make_shared<ServiceRequest>();
             case MType::RSP_SERVICE:
                 return std::make_shared<ServiceResponse>();
+            case MType::REQ_RPC_BATCH:
+                return std::make_shared<BatchRequest>();
+            case MType::RSP_RPC_BATCH:
+                return std::make_shared<BatchResponse>();
+            case MType::REQ_CANCEL:
+                return std::make_shared<CancelRequest>();
         }
         return BaseMessage::ptr();
     }
@@ -7,8 +7,17 @@
 #include <muduo/net/TcpClient.h>
 #include <muduo/net/TcpConnection.h>
 #include <muduo/net/TcpServer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 #include "abstract.hpp"
+#include "compress.hpp"
 #include "detail.hpp"
 #include "fields.hpp"
 #include "message.hpp"
@@ -35,6 +44,22 @@ class MuduoBuffer : public BaseBuffer {
     virtual std::string retrieveAsString(size_t len) override {
         return _buf->retrieveAsString(len);
     }
+    virtual const char* peek() override {
+        return _buf->peek();
+    }
+    virtual void retrieve(size_t len) override {
+        _buf->retrieve(len);
+    }
+    virtual void appendInt32(int32_t val) override {
+        // 与peekInt32对应，写入时转换为网络字节序
+        _buf->appendInt32(val);
+    }
+    virtual void appendInt64(int64_t val) override {
+        _buf->appendInt64(val);
+    }
+    virtual void append(const char* data, size_t len) override {
+        _buf->append(data, len);
+    }
 
    private:
     muduo::net::Buffer* _buf;
@@ -50,8 +75,41 @@ class BufferFactory {
 class LVProtocol : public BaseProtocol {
    public:
     // |--Len--|--VALUE--|
-    // |--Len--|--mtype--|--idlen--|--id--|--body--|
+    // |--Len--|--mtype--|--id--|--body--|
+    // id为定长8字节的请求序号；mtype字段低16位为消息类型，高16位为标志位
+    // 正文超过chunkSize时拆分为多个分片帧，每个分片帧都带有相同的mtype与id，最后一片带有结束标志
     using ptr = std::shared_ptr<LVProtocol>;
+    LVProtocol(CodecType codec = CodecType::JSON) : _codec(codec) {}
+    // 设置发送消息时正文使用的编码方式，接收时根据标志位自动识别
+    virtual void setCodec(CodecType codec) override {
+        _codec = codec;
+    }
+    // 正文长度达到阈值时使用LZ4压缩，0表示不压缩
+    virtual void setCompressThreshold(size_t threshold) override {
+        _compress_threshold = threshold;
+    }
+    // 单条消息(分片重组后/解压后)的长度上限，同时也是连接上正在重组的分片总量的上限
+    virtual void setMaxMessageSize(size_t size) override {
+        _max_message_size = size;
+    }
+    virtual uint32_t capabilities() override {
+        return CAP_BINARY_BODY | CAP_COMPRESS | CAP_CHUNK;
+    }
+    // 未握手(对端为旧版本)时沿用本端的配置；握手后双方都支持BINARY时自动使用BINARY编码
+    virtual void setPeerCapabilities(uint32_t caps) override {
+        _peer_caps.store(caps);
+        _negotiated.store(true);
+    }
+    virtual bool negotiated(uint32_t cap) override {
+        return _negotiated.load() && (_peer_caps.load() & cap) == cap;
+    }
+    // 复制协议配置，不复制分片重组状态，用于为每条连接创建独立的协议对象
+    virtual BaseProtocol::ptr clone() override {
+        auto proto = std::make_shared<LVProtocol>(_codec);
+        proto->_compress_threshold = _compress_threshold;
+        proto->_max_message_size = _max_message_size;
+        return proto;
+    }
     // 判断缓冲区中的数据量是否足够一条消息的处理
     virtual bool canProcessed(const BaseBuffer::ptr& buf) override {
         if (buf->readableSize() < lenFieldsLength) {
@@ -63,50 +121,194 @@ class LVProtocol : public BaseProtocol {
         }
         return true;
     }
+    // 返回true但msg为空时，表示收到的是一个中间分片，消息尚未完整
     virtual bool onMessage(const BaseBuffer::ptr& buf, BaseMessage::ptr& msg) override {
         // 当调用onMessage的时候，默认认为缓冲区中的数据足够一条完整的消息
-        int32_t total_len = buf->readInt32();   // 读取总长度
-        MType mtype = (MType)buf->readInt32();  // 读取数据类型
-        int32_t idlen = buf->readInt32();       // 读取id长度
-        int32_t body_len = total_len - idlen - idlenFieldsLength - mtypeFieldsLength;
-        std::string id = buf->retrieveAsString(idlen);
-        std::string body = buf->retrieveAsString(body_len);
+        // 直接在缓冲区上解析，消息构造完成后再统一移动读指针，正文不再额外拷贝
+        const char* data = buf->peek();
+        int32_t total_len = peekInt32(data);                 // 读取总长度
+        int32_t mfield = peekInt32(data + lenFieldsLength);  // 读取数据类型及标志位
+        int32_t body_len = total_len - mtypeFieldsLength - idFieldsLength;
+        if (body_len < 0) {
+            ELOG("消息长度字段错误！");
+            return false;
+        }
+        RequestId id = peekInt64(data + lenFieldsLength + mtypeFieldsLength);  // 读取请求id
+        const char* body = data + lenFieldsLength + mtypeFieldsLength + idFieldsLength;
+        MType mtype = (MType)(mfield & mtypeMask);
+        CodecType codec = (mfield & flagBinaryBody) ? CodecType::BINARY : CodecType::JSON;
+        bool retrieved = false;
+        std::string assembled;
+        if (mfield & flagChunk) {
+            // 分片先拷贝到重组缓冲中，随后即可从输入缓冲区中移除
+            if (_chunk_bytes + body_len > _max_message_size) {
+                ELOG("分片重组数据超过上限：%zu", _max_message_size);
+                return false;
+            }
+            auto key = std::make_pair(id, (int32_t)mtype);
+            std::string& partial = _chunks[key];
+            partial.append(body, body_len);
+            _chunk_bytes += body_len;
+            buf->retrieve(total_len + lenFieldsLength);
+            retrieved = true;
+            if ((mfield & flagLastChunk) == 0) {
+                msg.reset();
+                return true;
+            }
+            assembled.swap(partial);
+            _chunks.erase(key);
+            _chunk_bytes -= assembled.size();
+            body = assembled.data();
+            body_len = assembled.size();
+        }
         msg = MessageFactory::create(mtype);
         if (msg.get() == nullptr) {
             ELOG("消息类型错误，构造消息对象失败！");
             return false;
         }
-        bool ret = msg->unserialize(body);
+        std::string raw;
+        if (mfield & flagCompressed) {
+            // |--rawlen--|--lz4 block--|
+            if (body_len < (int32_t)rawlenFieldsLength) {
+                ELOG("压缩正文长度错误！");
+                return false;
+            }
+            int32_t raw_len = peekInt32(body);
+            if (raw_len < 0 || (size_t)raw_len > _max_message_size) {
+                ELOG("压缩正文的原始长度错误：%d", raw_len);
+                return false;
+            }
+            raw.resize(raw_len);
+            if (LZ4::decompress(body + rawlenFieldsLength, body_len - rawlenFieldsLength, &raw[0], raw_len) == false) {
+                ELOG("消息正文解压失败！");
+                return false;
+            }
+            body = raw.data();
+            body_len = raw_len;
+        }
+        bool ret = msg->unserialize(body, body_len, codec);
         if (ret == false) {
             ELOG("消息正文反序列化失败！");
             return false;
         }
         msg->setId(id);
         msg->setMType(mtype);
+        if (retrieved == false) {
+            buf->retrieve(total_len + lenFieldsLength);
+        }
         return true;
     }
     virtual std::string serialize(const BaseMessage::ptr& msg) override {
-        // |--Len--|--mtype--|--idlen--|--id--|--body--|
-        std::string body = msg->serialize();
-        std::string id = msg->rid();
-        auto mtype = htonl((int32_t)msg->mtype());
-        int32_t idlen = htonl(id.size());
-        int32_t h_total_len = mtypeFieldsLength + idlenFieldsLength + id.size() + body.size();
-        int32_t n_total_len = htonl(h_total_len);
-        std::string result;
-        result.reserve(h_total_len + lenFieldsLength);
-        result.append((char*)&n_total_len, lenFieldsLength);
-        result.append((char*)&mtype, mtypeFieldsLength);
-        result.append((char*)&idlen, idlenFieldsLength);
-        result.append(id);
-        result.append(body);
-        return result;
+        muduo::net::Buffer buf;
+        MuduoBuffer out(&buf);
+        serialize(msg, out);
+        return buf.retrieveAllAsString();
+    }
+    virtual void serialize(const BaseMessage::ptr& msg, BaseBuffer& out) override {
+        // 各字段依次追加到缓冲区末尾，可以连续写入多条消息
+        CodecType codec = sendCodec();
+        int32_t mfield = (int32_t)msg->mtype();
+        if (codec == CodecType::BINARY) mfield |= flagBinaryBody;
+        // 预编码的请求连同缓存的帧头一起编码成整帧，不需要压缩或分片时直接写入
+        std::string frame;
+        auto head = [this, mfield](std::string& prefix) {
+            prefix.append(lenFieldsLength + mtypeFieldsLength + idFieldsLength, '\0');
+            int32_t be32 = htonl(mfield);
+            memcpy(&prefix[lenFieldsLength], &be32, sizeof(be32));
+        };
+        if (msg->encodeFrame(codec, head, frame) && singleFrame(frame.size() - lenFieldsLength - mtypeFieldsLength - idFieldsLength)) {
+            int32_t len = htonl(frame.size() - lenFieldsLength);
+            memcpy(&frame[0], &len, sizeof(len));
+            RequestId id = msg->rid();
+            int32_t hi = htonl((uint32_t)(id >> 32)), lo = htonl((uint32_t)id);
+            memcpy(&frame[lenFieldsLength + mtypeFieldsLength], &hi, sizeof(hi));
+            memcpy(&frame[lenFieldsLength + mtypeFieldsLength + 4], &lo, sizeof(lo));
+            return out.append(frame.data(), frame.size());
+        }
+        std::string body;
+        mfield = packBody(msg, codec, body);
+        if (body.size() <= chunkSize || peerSupports(CAP_CHUNK) == false) {
+            return appendFrame(out, mfield, msg->rid(), body.data(), body.size());
+        }
+        for (size_t offset = 0; offset < body.size(); offset += chunkSize) {
+            size_t len = std::min(chunkSize, body.size() - offset);
+            int32_t flags = mfield | flagChunk;
+            if (offset + len == body.size()) flags |= flagLastChunk;
+            appendFrame(out, flags, msg->rid(), body.data() + offset, len);
+        }
     }
 
    private:
+    // |--Len--|--mtype--|--id--|--body--|
+    void appendFrame(BaseBuffer& out, int32_t mfield, RequestId id, const char* body, size_t len) {
+        out.appendInt32(mtypeFieldsLength + idFieldsLength + len);
+        out.appendInt32(mfield);
+        out.appendInt64(id);
+        out.append(body, len);
+    }
+    // 发送正文使用的编码方式
+    CodecType sendCodec() {
+        if (_negotiated.load()) {
+            return peerSupports(CAP_BINARY_BODY) ? CodecType::BINARY : CodecType::JSON;
+        }
+        return _codec;
+    }
+    // 长度为body_len的正文既不压缩也不分片，可以作为单个帧直接发送
+    bool singleFrame(size_t body_len) {
+        if (body_len > chunkSize && peerSupports(CAP_CHUNK)) {
+            return false;
+        }
+        return _compress_threshold == 0 || body_len < _compress_threshold || peerSupports(CAP_COMPRESS) == false;
+    }
+    // 序列化正文，按需压缩，返回带标志位的mtype字段
+    int32_t packBody(const BaseMessage::ptr& msg, CodecType codec, std::string& body) {
+        int32_t mfield = (int32_t)msg->mtype();
+        if (codec == CodecType::BINARY) mfield |= flagBinaryBody;
+        body = msg->serialize(codec);
+        if (_compress_threshold == 0 || body.size() < _compress_threshold || peerSupports(CAP_COMPRESS) == false) {
+            return mfield;
+        }
+        int32_t raw_len = htonl(body.size());
+        std::string packed((char*)&raw_len, rawlenFieldsLength);
+        LZ4::compress(body.data(), body.size(), packed);
+        // 压缩后没有变小（如已经压缩过的数据）就直接发送原文
+        if (packed.size() >= body.size()) {
+            return mfield;
+        }
+        body.swap(packed);
+        return mfield | flagCompressed;
+    }
+    // 握手完成前不知道对端能否解析压缩或分片的帧(可能是旧版本)，按不支持处理
+    bool peerSupports(Capability cap) {
+        return _negotiated.load() && (_peer_caps.load() & cap);
+    }
+    static int32_t peekInt32(const char* data) {
+        int32_t be32 = 0;
+        memcpy(&be32, data, sizeof(be32));
+        return ntohl(be32);
+    }
+    static uint64_t peekInt64(const char* data) {
+        return ((uint64_t)(uint32_t)peekInt32(data) << 32) | (uint32_t)peekInt32(data + 4);
+    }
+
     const size_t lenFieldsLength = 4;
     const size_t mtypeFieldsLength = 4;
-    const size_t idlenFieldsLength = 4;
+    const size_t idFieldsLength = 8;
+    const size_t rawlenFieldsLength = 4;
+    const size_t chunkSize = 1 << 15;  // 分片正文的最大长度，保证单帧远小于接收端的缓冲区上限
+    const int32_t mtypeMask = 0xffff;
+    const int32_t flagBinaryBody = 1 << 16;  // 正文使用BINARY编码
+    const int32_t flagCompressed = 1 << 17;  // 正文经过LZ4压缩
+    const int32_t flagChunk = 1 << 18;       // 分片帧
+    const int32_t flagLastChunk = 1 << 19;   // 最后一个分片
+    CodecType _codec;
+    size_t _compress_threshold = 0;
+    size_t _max_message_size = 1 << 26;
+    std::atomic<bool> _negotiated{false};
+    std::atomic<uint32_t> _peer_caps{0};
+    // 正在重组的分片，以(id, mtype)区分不同的消息
+    std::map<std::pair<RequestId, int32_t>, std::string> _chunks;
+    size_t _chunk_bytes = 0;
 };
 class ProtocolFactory {
    public:
@@ -116,26 +318,40 @@ class ProtocolFactory {
     }
 };
 
-class MyConnection : public BaseConnection {
+class MyConnection : public BaseConnection, public std::enable_shared_from_this<MyConnection> {
    public:
     using ptr = std::shared_ptr<MyConnection>;
     MyConnection(const muduo::net::TcpConnectionPtr& conn,
                     const BaseProtocol::ptr& protocol)
-        : _protocol(protocol), _conn(conn) {}
+        : _protocol(protocol), _conn(conn), _flush_pending(false) {}
+    virtual BaseProtocol::ptr protocol() override {
+        return _protocol;
+    }
     virtual void sendInLoop(const BaseMessage::ptr& msg) override {
-		DLOG("发送消息 rid=%s", msg->rid().c_str());
-        std::string body = _protocol->serialize(msg);
-		_conn->getLoop()->runInLoop([conn = _conn, body]() {
-			conn->send(body);
-		});
+		DLOG("发送消息 rid=%lu", msg->rid());
+        // 序列化在锁外完成，锁内只做链表节点的转移，避免多个工作线程互相等待编码
+        std::list<Outgoing> item(1);
+        item.front().rid = msg->rid();
+        MuduoBuffer out(&item.front().frames);
+        _protocol->serialize(msg, out);
+        bool need_flush = false;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.splice(_pending.end(), item);
+            need_flush = !_flush_pending;
+            _flush_pending = true;
+        }
+        // 同一轮事件循环内发送的多个帧合并为一次写出，只有第一个帧负责安排刷新
+        if (need_flush) {
+            _conn->getLoop()->queueInLoop(std::bind(&MyConnection::flush, shared_from_this()));
+        }
     }
     virtual void send(const BaseMessage::ptr& msg) override {
-		DLOG("发送消息 rid=%s", msg->rid().c_str());
-        std::string body = _protocol->serialize(msg);
-        _conn->send(body);
+        sendInLoop(msg);
     }
     virtual void shutdown() override {
-        _conn->shutdown();
+        // 先写出尚未刷新的数据再关闭，否则关闭后的send会被muduo丢弃
+        _conn->getLoop()->runInLoop(std::bind(&MyConnection::flushAndShutdown, shared_from_this()));
     }
     virtual bool connected() override {
         return _conn->connected();
@@ -146,8 +362,102 @@ class MyConnection : public BaseConnection {
 	}
 
    private:
+    // 一条待发送的消息：大消息被协议拆成多个分片帧，依次存放在frames中
+    struct Outgoing {
+        RequestId rid = 0;
+        muduo::net::Buffer frames;
+    };
+    // 在io线程中执行，各条消息的帧轮流交给TcpConnection，每次每条消息只写出一帧
+    // 小消息不必等待排在前面的大消息全部写完；同一条消息的帧保持顺序
+    void flush() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_pending.empty() && _sending.empty()) {
+                _flush_pending = false;
+                return;
+            }
+            merge();
+        }
+        if (_conn->connected() == false) {
+            _sending.clear();
+            _streams.clear();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending.clear();
+            _flush_pending = false;
+            return;
+        }
+        // 每轮事件循环最多写出sliceLength，其他连接不必等待这条连接写完
+        while (_out.readableBytes() < sliceLength && _sending.empty() == false) {
+            auto it = _sending.begin();
+            size_t len = frameLength(it->frames);
+            _out.append(it->frames.peek(), len);
+            it->frames.retrieve(len);
+            if (it->frames.readableBytes() == 0) {
+                _streams.erase(it->rid);
+                _sending.erase(it);
+            } else {
+                _sending.splice(_sending.end(), _sending, it);
+            }
+        }
+        _conn->send(&_out);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_sending.empty() && _pending.empty()) {
+                _flush_pending = false;
+                return;
+            }
+        }
+        _conn->getLoop()->queueInLoop(std::bind(&MyConnection::flush, shared_from_this()));
+    }
+    // 持有_mutex时调用：把新发送的消息移入_sending
+    // 与正在发送的消息id相同的消息(如取消帧)追加在它的帧之后，不会先于它到达对端
+    void merge() {
+        while (_pending.empty() == false) {
+            auto it = _pending.begin();
+            auto stream = _streams.find(it->rid);
+            if (stream != _streams.end()) {
+                stream->second->frames.append(it->frames.peek(), it->frames.readableBytes());
+                _pending.erase(it);
+                continue;
+            }
+            _sending.splice(_sending.end(), _pending, it);
+            _streams[it->rid] = it;
+        }
+    }
+    void flushAndShutdown() {
+        // 关闭后muduo会丢弃新的数据，剩余的帧一次全部写出
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            merge();
+        }
+        if (_conn->connected()) {
+            for (auto& item : _sending) {
+                _out.append(item.frames.peek(), item.frames.readableBytes());
+            }
+            _conn->send(&_out);
+        }
+        _out.retrieveAll();
+        _sending.clear();
+        _streams.clear();
+        _conn->shutdown();
+    }
+    // 缓冲区头部第一帧的长度
+    static size_t frameLength(muduo::net::Buffer& buf) {
+        int32_t be32 = 0;
+        memcpy(&be32, buf.peek(), sizeof(be32));
+        return std::min(ntohl(be32) + sizeof(be32), buf.readableBytes());
+    }
+
+    static const size_t sliceLength = 1 << 16;
     BaseProtocol::ptr _protocol;
     muduo::net::TcpConnectionPtr _conn;
+    std::mutex _mutex;
+    std::list<Outgoing> _pending;  // 等待写出的消息，由_mutex保护
+    // 以下只在io线程中访问
+    std::list<Outgoing> _sending;  // 已取出、还未写完的消息，按轮转顺序排列
+    std::unordered_map<RequestId, std::list<Outgoing>::iterator> _streams;  // 按消息id索引_sending
+    muduo::net::Buffer _out;       // 本轮写出的帧
+    bool _flush_pending;
 };
 class ConnectionFactory {
    public:
@@ -181,6 +491,18 @@ class MuduoServer : public BaseServer {
 	void setThreadNum(int numThreads){
 		_server.setThreadNum(numThreads);
 	}
+	// 设置服务端发出消息的正文编码方式，仅对未握手的连接生效，握手成功的连接由协商结果决定
+	void setCodec(CodecType codec){
+		_protocol->setCodec(codec);
+	}
+	// 设置服务端发出消息的压缩阈值，0表示不压缩
+	void setCompressThreshold(size_t threshold){
+		_protocol->setCompressThreshold(threshold);
+	}
+	// 设置单条消息的长度上限，超过分片大小的消息会自动分片传输
+	void setMaxMessageSize(size_t size){
+		_protocol->setMaxMessageSize(size);
+	}
 
    private:
     void onConnection(const muduo::net::TcpConnectionPtr& conn) {
@@ -191,12 +513,16 @@ class MuduoServer : public BaseServer {
                 //msg->setId(UUID::uuid());
                 msg->setMType(MType::RSP_CONNECT);
                 msg->setRCode(RCode::RCODE_CONNECT_OVERFLOW);
-                conn->send(_protocol->serialize(msg));
+                muduo::net::Buffer buf;
+                MuduoBuffer out(&buf);
+                _protocol->serialize(msg, out);
+                conn->send(&buf);
                 conn->shutdown();
                 return;
             }
 
-			auto my_conn = ConnectionFactory::create(conn, _protocol);
+			// 每条连接使用独立的协议对象，分片重组等状态互不干扰
+			auto my_conn = ConnectionFactory::create(conn, _protocol->clone());
 			DLOG("连接建立 %s:%d", my_conn->getHost().first.c_str(), my_conn->getHost().second);
             {
                 std::unique_lock<std::mutex> lock(_mutex);
@@ -222,9 +548,20 @@ class MuduoServer : public BaseServer {
     }
     void onMessage(const muduo::net::TcpConnectionPtr& conn, muduo::net::Buffer* buf, muduo::Timestamp) {
         DLOG("连接有数据到来，开始处理！");
+        BaseConnection::ptr base_conn;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _conns.find(conn);
+            if (it == _conns.end()) {
+                conn->shutdown();
+                return;
+            }
+            base_conn = it->second;
+        }
+        auto protocol = base_conn->protocol();
         auto base_buf = BufferFactory::create(buf);
         while (1) {
-            if (_protocol->canProcessed(base_buf) == false) {
+            if (protocol->canProcessed(base_buf) == false) {
                 // 数据不足
                 if (base_buf->readableSize() > maxDataSize) {
                     conn->shutdown();
@@ -236,22 +573,15 @@ class MuduoServer : public BaseServer {
             }
             // DLOG("缓冲区中数据可处理！");
             BaseMessage::ptr msg;
-            bool ret = _protocol->onMessage(base_buf, msg);
+            bool ret = protocol->onMessage(base_buf, msg);
             if (ret == false) {
                 conn->shutdown();
                 ELOG("缓冲区中数据错误！");
                 return;
             }
-            // DLOG("消息反序列化成功！")
-            BaseConnection::ptr base_conn;
-            {
-                std::unique_lock<std::mutex> lock(_mutex);
-                auto it = _conns.find(conn);
-                if (it == _conns.end()) {
-                    conn->shutdown();
-                    return;
-                }
-                base_conn = it->second;
+            if (msg.get() == nullptr) {
+                // 收到中间分片，继续处理后续数据
+                continue;
             }
             // DLOG("调用回调函数进行消息处理！");
             if (_cb_message)
@@ -276,15 +606,69 @@ class ServerFactory {
     }
 };
 
+// 进程内所有客户端共享的事件循环组：固定数量的io线程，新建的客户端按轮询分配到各个事件循环上
+// 线程数需要在创建第一个客户端之前通过setThreadNum设置，默认为CPU核数
+// 客户端的回调都在共享的io线程中执行，回调中不要做阻塞操作(如同步调用)，否则会拖慢同一线程上的其他客户端
+class EventLoopGroup {
+   public:
+    static EventLoopGroup& instance() {
+        // 有意不释放：全局对象中的客户端在进程退出析构时仍可能用到事件循环
+        static EventLoopGroup* group = new EventLoopGroup(_thread_num.load());
+        return *group;
+    }
+    static void setThreadNum(size_t num) {
+        _thread_num.store(num);
+    }
+    // 在组内的io线程中创建客户端时跳过该线程自己的事件循环：客户端构造时同步等待连接与握手，在自己的事件循环中等待会死锁
+    muduo::net::EventLoop* next() {
+        size_t index = _next.fetch_add(1, std::memory_order_relaxed);
+        muduo::net::EventLoop* loop = _loops[index % _loops.size()];
+        if (loop == muduo::net::EventLoop::getEventLoopOfCurrentThread() && _loops.size() > 1) {
+            loop = _loops[(index + 1) % _loops.size()];
+        }
+        return loop;
+    }
+    size_t size() {
+        return _loops.size();
+    }
+
+   private:
+    explicit EventLoopGroup(size_t num) {
+        if (num == 0) num = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < num; i++) {
+            _threads.emplace_back(new muduo::net::EventLoopThread(muduo::net::EventLoopThread::ThreadInitCallback(),
+                                                                  "ClientLoop" + std::to_string(i)));
+            _loops.push_back(_threads.back()->startLoop());
+        }
+        ILOG("客户端事件循环组启动，io线程数：%zu", num);
+    }
+
+    static inline std::atomic<size_t> _thread_num{0};
+    std::vector<std::unique_ptr<muduo::net::EventLoopThread>> _threads;
+    std::vector<muduo::net::EventLoop*> _loops;
+    std::atomic<size_t> _next{0};
+};
+
 class MuduoClient : public BaseClient {
    public:
     using ptr = std::shared_ptr<MuduoClient>;
     MuduoClient(const std::string& sip, int sport)
         : _protocol(ProtocolFactory::create()),
-          _baseloop(_loopthread.startLoop()),
-          _downlatch(1),
+          _baseloop(EventLoopGroup::instance().next()),
           _client(_baseloop, muduo::net::InetAddress(sip, sport), "MuduoClient") {}
+    ~MuduoClient() {
+        detach();
+    }
     virtual void connect() override {
+        connect(0);
+    }
+    // 连接服务器，timeout_ms内没有连上时停止重试并返回false；0表示一直等到连上为止
+    bool connect(int timeout_ms) {
+        // 事件循环组只有一个io线程且正在其中创建客户端时，连接建立的回调永远不会执行
+        if (inOwnLoop()) {
+            ELOG("不能在客户端所在的io线程中同步连接服务器！");
+            return false;
+        }
         DLOG("设置回调函数，连接服务器");
         _client.setConnectionCallback(std::bind(&MuduoClient::onConnection, this, std::placeholders::_1));
         // 设置连接消息的回调
@@ -293,46 +677,127 @@ class MuduoClient : public BaseClient {
 
         // 连接服务器
         _client.connect();
-        _downlatch.wait();
+        std::unique_lock<std::mutex> lock(_conn_mutex);
+        auto established = [this]() { return _established; };
+        if (timeout_ms <= 0) {
+            _conn_cv.wait(lock, established);
+        } else if (_conn_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), established) == false) {
+            lock.unlock();
+            _client.stop();  // 服务端不可达时连接器会一直重试，超时后停止
+            ELOG("连接服务器超时！");
+            return false;
+        }
         DLOG("连接服务器成功！");
+        return true;
     }
     virtual void shutdown() override {
         return _client.disconnect();
     }
     virtual bool send(const BaseMessage::ptr& msg) override {
-        if (connected() == false) {
+        BaseConnection::ptr conn;
+        {
+            std::unique_lock<std::mutex> lock(_conn_mutex);
+            conn = _conn;
+        }
+        if (conn.get() == nullptr || conn->connected() == false) {
             ELOG("连接已断开！");
             return false;
         }
-        _conn->send(msg);
+        conn->send(msg);
         return true;
     }
     virtual BaseConnection::ptr connection() override {
-		for(int i = 1;i <= 50;i++){
-			if(_conn == nullptr){
-				usleep(1000 * 100);
-			}
-		}
+		std::unique_lock<std::mutex> lock(_conn_mutex);
+		_conn_cv.wait_for(lock, std::chrono::seconds(5), [this]() { return _conn != nullptr; });
 		if(_conn == nullptr){
 			ELOG("服务器连接失败");
 			exit(0);
 		}
         return _conn;
     }
+    // 连接状态在io线程中更新，其他线程可以随时查询
     virtual bool connected() {
-        return (_conn && _conn->connected());
+        return _connected.load();
+    }
+	// 设置客户端发出消息的正文编码方式，仅在服务端不支持握手时生效
+	void setCodec(CodecType codec){
+		_protocol->setCodec(codec);
+	}
+	// 设置客户端发出消息的压缩阈值，0表示不压缩
+	void setCompressThreshold(size_t threshold){
+		_protocol->setCompressThreshold(threshold);
+	}
+	// 设置单条消息的长度上限，超过分片大小的消息会自动分片传输
+	void setMaxMessageSize(size_t size){
+		_protocol->setMaxMessageSize(size);
+	}
+	// 当前线程是否是本客户端的io线程，在其中同步等待响应会死锁
+	bool inOwnLoop(){
+		return muduo::net::EventLoop::getEventLoopOfCurrentThread() == _baseloop;
+	}
+	// 在客户端的事件循环中执行cb，当前就在事件循环线程中时直接执行
+	void runInLoop(const std::function<void()>& cb){
+		_baseloop->runInLoop(cb);
+	}
+	// 在客户端的事件循环中周期性执行cb
+	muduo::net::TimerId runEvery(double interval, const std::function<void()>& cb){
+		return _baseloop->runEvery(interval, cb);
+	}
+	void cancelTimer(muduo::net::TimerId timer){
+		_baseloop->cancel(timer);
+	}
+
+   protected:
+    // 在事件循环中清除指向本对象的回调并断开连接，等事件循环执行完毕后返回
+    // 派生类须在析构函数开头调用：基类析构时派生类的成员已经释放，io线程中的回调不能再访问它们
+    void detach() {
+        if (_detached.exchange(true)) {
+            return;
+        }
+        auto clear = [this]() {
+            _client.setConnectionCallback(muduo::net::defaultConnectionCallback);
+            _client.setMessageCallback(muduo::net::defaultMessageCallback);
+            auto conn = _client.connection();
+            if (conn) {
+                conn->setConnectionCallback(muduo::net::defaultConnectionCallback);
+                conn->setMessageCallback(muduo::net::defaultMessageCallback);
+            }
+            _cb_connection = nullptr;
+            _cb_close = nullptr;
+            _cb_message = nullptr;
+            _client.disconnect();
+        };
+        if (_baseloop->isInLoopThread()) {
+            clear();
+        } else {
+            muduo::CountDownLatch latch(1);
+            _baseloop->runInLoop([&]() {
+                clear();
+                latch.countDown();
+            });
+            latch.wait();
+        }
     }
 
    private:
     void onConnection(const muduo::net::TcpConnectionPtr& conn) {
         if (conn->connected()) {
 			DLOG("连接建立！");
-            _downlatch.countDown();  // 计数--，为0时唤醒阻塞
-            _conn = ConnectionFactory::create(conn, _protocol);
-			if(_cb_connection) _cb_connection(_conn);
+            auto my_conn = ConnectionFactory::create(conn, _protocol);
+            {
+                std::unique_lock<std::mutex> lock(_conn_mutex);
+                _conn = my_conn;
+                _established = true;
+            }
+            _connected.store(true);
+            _conn_cv.notify_all();  // 唤醒等待连接建立的线程
+			if(_cb_connection) _cb_connection(my_conn);
         } else {
 			DLOG("连接断开！");
+            // 先更新状态再回调，回调之后查询到的一定是断开状态
+            _connected.store(false);
 			if(_cb_close) _cb_close(_conn);
+            std::unique_lock<std::mutex> lock(_conn_mutex);
             _conn.reset();
         }
     }
@@ -358,6 +823,9 @@ class MuduoClient : public BaseClient {
                 ELOG("缓冲区中数据错误！");
                 return;
             }
+            if (msg.get() == nullptr) {
+                continue;
+            }
             // DLOG("缓冲区中数据解析完毕，调用回调函数进行处理！");
             if (_cb_message)
                 _cb_message(_conn, msg);
@@ -367,11 +835,14 @@ class MuduoClient : public BaseClient {
    private:
     const size_t maxDataSize = (1 << 16);
     BaseProtocol::ptr _protocol;
+    std::mutex _conn_mutex;  // 保护_conn与_established：只在io线程中修改，其他线程加锁读取
+    std::condition_variable _conn_cv;
     BaseConnection::ptr _conn;
-    muduo::CountDownLatch _downlatch;
-    muduo::net::EventLoopThread _loopthread;
-    muduo::net::EventLoop* _baseloop;
+    bool _established = false;  // 是否曾经连上过
+    std::atomic<bool> _connected{false};
+    muduo::net::EventLoop* _baseloop;  // 从共享的事件循环组中分配
     muduo::net::TcpClient _client;
+    std::atomic<bool> _detached{false};
 };
 
 class ClientFactory {
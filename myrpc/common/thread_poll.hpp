@@ -1,35 +1,113 @@
+#pragma once
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <new>
+#include <vector>
 
 namespace myrpc {
 
+// 只能移动的任务对象：较小的可调用对象(如只捕获几个智能指针的lambda)直接存放在对象内部，不再分配堆内存
+class Task {
+public:
+	Task() : ops(nullptr) {}
+	template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+	Task(F &&f) {
+		using Fn = typename std::decay<F>::type;
+		if constexpr (storedInline<Fn>()) {
+			new (storage) Fn(std::forward<F>(f));
+			ops = &inlineOps<Fn>;
+		} else {
+			*reinterpret_cast<Fn **>(storage) = new Fn(std::forward<F>(f));
+			ops = &heapOps<Fn>;
+		}
+	}
+	Task(Task &&other) noexcept : ops(other.ops) {
+		if (ops) {
+			ops->move(storage, other.storage);
+			other.ops = nullptr;
+		}
+	}
+	Task &operator=(Task &&other) noexcept {
+		if (this != &other) {
+			reset();
+			ops = other.ops;
+			if (ops) {
+				ops->move(storage, other.storage);
+				other.ops = nullptr;
+			}
+		}
+		return *this;
+	}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task() {
+		reset();
+	}
+	void operator()() {
+		ops->invoke(storage);
+	}
+	explicit operator bool() const {
+		return ops != nullptr;
+	}
+	// 可调用对象是否直接存放在任务对象内部，热路径上提交的任务可以据此做静态检查
+	template <typename F>
+	static constexpr bool storedInline() {
+		using Fn = typename std::decay<F>::type;
+		return sizeof(Fn) <= inlineSize && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<Fn>::value;
+	}
+
+private:
+	// 能放下rpc请求的任务(连接、请求、方法描述等几个智能指针)，任务对象正好占两个缓存行
+	static const size_t inlineSize = 120;
+	struct Ops {
+		void (*invoke)(void *);
+		void (*move)(void *dst, void *src);  // 移动到dst并销毁src
+		void (*destroy)(void *);
+	};
+	template <typename Fn>
+	static constexpr Ops inlineOps = {
+		[](void *p) { (*static_cast<Fn *>(p))(); },
+		[](void *dst, void *src) {
+			new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+			static_cast<Fn *>(src)->~Fn();
+		},
+		[](void *p) { static_cast<Fn *>(p)->~Fn(); }};
+	template <typename Fn>
+	static constexpr Ops heapOps = {
+		[](void *p) { (**static_cast<Fn **>(p))(); },
+		[](void *dst, void *src) { *static_cast<Fn **>(dst) = *static_cast<Fn **>(src); },
+		[](void *p) { delete *static_cast<Fn **>(p); }};
+	void reset() {
+		if (ops) {
+			ops->destroy(storage);
+			ops = nullptr;
+		}
+	}
+
+	alignas(std::max_align_t) unsigned char storage[inlineSize];
+	const Ops *ops;
+};
+
+// 工作窃取线程池：每个工作线程有自己的任务队列，空闲时从其他线程的队列中窃取任务
+// 外部线程(如io线程)提交的任务按轮询分散到各个队列，工作线程中提交的任务放入自己的队列，避免所有线程争用同一把锁
+// 只有存在休眠的线程时才唤醒，忙碌时提交任务不需要系统调用
 class ThreadPool {
 public:
 	using ptr = std::shared_ptr<ThreadPool>;
-	ThreadPool(size_t threads) : stop(false), numThreads(threads) {
+	ThreadPool(size_t threads) : stop(false), numThreads(threads), multiCore(std::thread::hardware_concurrency() > 1), queues(threads) {
 		for (size_t i = 0; i < threads; ++i) {
-			workers.emplace_back([this] {
-				while (true) {
-					std::function<void()> task;
-					{
-						std::unique_lock<std::mutex> lock(queue_mutex);
-						this->condition.wait(lock, [this] { return this->stop || !this->tasks.empty(); });
-						if (this->stop && this->tasks.empty()) return;
-						task = std::move(this->tasks.front());
-						this->tasks.pop();
-					}
-					task();
-				}
-			});
+			workers.emplace_back([this, i] { run(i); });
 		}
 	}
 
 	~ThreadPool() {
 		{
-			std::unique_lock<std::mutex> lock(queue_mutex);
+			std::unique_lock<std::mutex> lock(sleep_mutex);
 			stop = true;
 		}
 		condition.notify_all();
@@ -37,24 +115,118 @@ public:
 			worker.join();
 		}
 	}
-	void enqueue(std::function<void()> task) {
+	template <typename F>
+	void enqueue(F &&f) {
+		if (queues.empty()) {
+			Task(std::forward<F>(f))();
+			return;
+		}
+		size_t index = current == this ? currentIndex : next.fetch_add(1, std::memory_order_relaxed) % queues.size();
 		{
-			std::unique_lock<std::mutex> lock(queue_mutex);
-			tasks.emplace(std::move(task));
+			std::unique_lock<std::mutex> lock(queues[index].mutex);
+			// 先计数再放入队列：任务一旦可见就可能被取走并减少计数，计数不能先减后加
+			pending.fetch_add(1);
+			queues[index].push(Task(std::forward<F>(f)));
 		}
-		condition.notify_one();
+		wakeOne();
 	}
 	int getThreadNum() {
 		return numThreads;
 	}
 
 private:
+	// 环形缓冲区实现的任务队列，容量为2的幂：任务对象较大，deque每个块只能放下几个，会频繁分配内存
+	struct alignas(64) WorkQueue {
+		std::mutex mutex;
+		std::vector<Task> ring = std::vector<Task>(16);
+		size_t head = 0;
+		size_t count = 0;
+		void push(Task &&task) {
+			if (count == ring.size()) {
+				std::vector<Task> bigger(ring.size() * 2);
+				for (size_t i = 0; i < count; i++) bigger[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+				ring.swap(bigger);
+				head = 0;
+			}
+			ring[(head + count) & (ring.size() - 1)] = std::move(task);
+			count++;
+		}
+		void pop(Task &task) {
+			task = std::move(ring[head]);
+			head = (head + 1) & (ring.size() - 1);
+			count--;
+		}
+	};
+
+	void run(size_t index) {
+		current = this;
+		currentIndex = index;
+		while (true) {
+			Task task;
+			if (take(index, task)) {
+				task();
+				continue;
+			}
+			// 短暂自旋后再休眠，连续到来的小任务不必每次都唤醒线程；单核上自旋只会抢占提交任务的线程
+			bool found = false;
+			for (int spin = 0; spin < spinRounds && multiCore && found == false; spin++) {
+				std::this_thread::yield();
+				found = pending.load() > 0;
+			}
+			if (found) continue;
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			sleepers.fetch_add(1);
+			// 每次从等待中返回都清除唤醒标记，包括被唤醒后任务已被其他线程取走、需要继续等待的情况
+			while (stop == false && pending.load() == 0) {
+				condition.wait(lock);
+				waking.store(false);
+			}
+			sleepers.fetch_sub(1);
+			if (stop && pending.load() == 0) return;
+		}
+	}
+	// 先取自己队列中的任务，没有时依次窃取其他队列中的任务
+	bool take(size_t index, Task &task) {
+		if (pending.load() == 0) return false;
+		for (size_t k = 0; k < queues.size(); k++) {
+			WorkQueue &queue = queues[(index + k) % queues.size()];
+			std::unique_lock<std::mutex> lock(queue.mutex);
+			if (queue.count == 0) continue;
+			queue.pop(task);
+			lock.unlock();
+			// 还有任务时把唤醒传递下去，一次提交的大量任务逐个唤醒休眠的线程
+			if (pending.fetch_sub(1) > 1) wakeOne();
+			return true;
+		}
+		return false;
+	}
+	// 已有线程被唤醒但还未开始取任务时不再重复唤醒，由它取到任务后继续传递
+	void wakeOne() {
+		// 与run中先增加sleepers再检查pending的顺序配合，不会丢失唤醒
+		if (sleepers.load() == 0 || waking.load()) return;
+		// 持锁时sleepers中的线程都在等待中，设置的唤醒标记一定会被其中被唤醒的线程清除
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		if (sleepers.load() == 0 || waking.load()) return;
+		waking.store(true);
+		lock.unlock();
+		// 解锁后再通知，被唤醒的线程不必再等待这把锁
+		condition.notify_one();
+	}
+
+	static const int spinRounds = 64;
+	static inline thread_local ThreadPool *current = nullptr;  // 当前线程所属的线程池
+	static inline thread_local size_t currentIndex = 0;
 	std::vector<std::thread> workers;
-	std::queue<std::function<void()>> tasks;
-	std::mutex queue_mutex;
+	std::mutex sleep_mutex;
 	std::condition_variable condition;
 	bool stop;
 	int numThreads;
+	bool multiCore;
+	std::vector<WorkQueue> queues;
+	std::atomic<size_t> pending{0};  // 所有队列中的任务总数
+	std::atomic<size_t> sleepers{0};
+	std::atomic<bool> waking{false};  // 已发出唤醒，被唤醒的线程还未运行
+	std::atomic<size_t> next{0};
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace myrpc {
+
+// 单层时间轮：每个槽位一把锁，添加定时只锁目标槽位，到期检查每次只处理一个槽位
+// 超过一圈的定时记录剩余圈数；精度为一个tick，适合请求超时这类不要求精确的场景
+// 定时不支持取消，到期回调需自行判断对象是否已经失效
+template <typename T>
+class TimerWheel {
+   public:
+    using ptr = std::shared_ptr<TimerWheel>;
+    using ExpireCallback = std::function<void(T&)>;
+    TimerWheel(int tick_ms, size_t slot_count, const ExpireCallback& cb)
+        : _tick_ms(tick_ms), _slots(slot_count), _cursor(0), _expire_cb(cb) {}
+
+    int tickMs() { return _tick_ms; }
+    // 尚未到期的定时数，为0时不必再调用tick
+    size_t size() { return _size.load(); }
+
+    // 返回true表示添加前时间轮为空，调用方需要开始周期性地调用tick
+    bool add(int64_t timeout_ms, const T& value) {
+        size_t ticks = timeout_ms <= _tick_ms ? 1 : (size_t)((timeout_ms + _tick_ms - 1) / _tick_ms);
+        size_t pos = (_cursor.load() + ticks) % _slots.size();
+        Slot& slot = _slots[pos];
+        std::unique_lock<std::mutex> lock(slot.mutex);
+        slot.entries.push_back(Entry{(ticks - 1) / _slots.size(), value});
+        return _size.fetch_add(1) == 0;
+    }
+
+    // 由定时器每隔tick_ms调用一次
+    void tick() {
+        size_t pos = (_cursor.fetch_add(1) + 1) % _slots.size();
+        Slot& slot = _slots[pos];
+        std::vector<T> expired;
+        {
+            std::unique_lock<std::mutex> lock(slot.mutex);
+            size_t keep = 0;
+            for (size_t i = 0; i < slot.entries.size(); i++) {
+                Entry& e = slot.entries[i];
+                if (e.rounds == 0) {
+                    expired.push_back(std::move(e.value));
+                } else {
+                    e.rounds--;
+                    if (keep != i) slot.entries[keep] = std::move(e);
+                    keep++;
+                }
+            }
+            slot.entries.erase(slot.entries.begin() + keep, slot.entries.end());
+        }
+        _size.fetch_sub(expired.size());
+        for (auto& value : expired) {
+            _expire_cb(value);
+        }
+    }
+
+   private:
+    struct Entry {
+        size_t rounds;  // 还需要转过的圈数
+        T value;
+    };
+    struct Slot {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+    };
+
+    int _tick_ms;
+    std::vector<Slot> _slots;
+    std::atomic<size_t> _cursor;
+    std::atomic<size_t> _size{0};
+    ExpireCallback _expire_cb;
+};
+
+}  // namespace myrpc
@@ -0,0 +1,112 @@
+#pragma once
+#include <jsoncpp/json/json.h>
+#include <initializer_list>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace myrpc {
+
+// C++类型与Json::Value之间的转换，供类型化的方法注册与调用使用
+// check: 判断Json::Value能否无损转换为T
+// as:    转换为T(调用前需先check)
+// to:    将T转换为Json::Value
+template <typename T, typename Enable = void>
+struct JsonTraits;
+
+template <>
+struct JsonTraits<bool> {
+    static bool check(const Json::Value& val) { return val.isBool(); }
+    static bool as(const Json::Value& val) { return val.asBool(); }
+    static Json::Value to(bool val) { return Json::Value(val); }
+};
+
+template <typename T>
+struct JsonTraits<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+    static bool check(const Json::Value& val) {
+        if (val.isInt64() == false) return false;
+        Json::Int64 v = val.asInt64();
+        return v >= (Json::Int64)std::numeric_limits<T>::min() && v <= (Json::Int64)std::numeric_limits<T>::max();
+    }
+    static T as(const Json::Value& val) { return (T)val.asInt64(); }
+    static Json::Value to(T val) { return Json::Value((Json::Int64)val); }
+};
+
+template <typename T>
+struct JsonTraits<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                                             !std::is_same<T, bool>::value>::type> {
+    static bool check(const Json::Value& val) {
+        return val.isUInt64() && val.asUInt64() <= (Json::UInt64)std::numeric_limits<T>::max();
+    }
+    static T as(const Json::Value& val) { return (T)val.asUInt64(); }
+    static Json::Value to(T val) { return Json::Value((Json::UInt64)val); }
+};
+
+template <typename T>
+struct JsonTraits<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static bool check(const Json::Value& val) { return val.isNumeric(); }
+    static T as(const Json::Value& val) { return (T)val.asDouble(); }
+    static Json::Value to(T val) { return Json::Value((double)val); }
+};
+
+template <>
+struct JsonTraits<std::string> {
+    static bool check(const Json::Value& val) { return val.isString(); }
+    static std::string as(const Json::Value& val) { return val.asString(); }
+    static Json::Value to(const std::string& val) { return Json::Value(val); }
+};
+
+// 字符串字面量只用于编码参数
+template <>
+struct JsonTraits<const char*> {
+    static Json::Value to(const char* val) { return Json::Value(val); }
+};
+template <>
+struct JsonTraits<char*> : JsonTraits<const char*> {};
+
+template <>
+struct JsonTraits<Json::Value> {
+    static bool check(const Json::Value&) { return true; }
+    static const Json::Value& as(const Json::Value& val) { return val; }
+    static Json::Value to(const Json::Value& val) { return val; }
+};
+
+template <typename T>
+struct JsonTraits<std::vector<T>> {
+    static bool check(const Json::Value& val) {
+        if (val.isArray() == false) return false;
+        for (Json::ArrayIndex i = 0; i < val.size(); i++) {
+            if (JsonTraits<T>::check(val[i]) == false) return false;
+        }
+        return true;
+    }
+    static std::vector<T> as(const Json::Value& val) {
+        std::vector<T> vec;
+        vec.reserve(val.size());
+        for (Json::ArrayIndex i = 0; i < val.size(); i++) vec.push_back(JsonTraits<T>::as(val[i]));
+        return vec;
+    }
+    static Json::Value to(const std::vector<T>& vec) {
+        Json::Value val(Json::arrayValue);
+        val.resize(vec.size());
+        for (Json::ArrayIndex i = 0; i < vec.size(); i++) val[i] = JsonTraits<T>::to(vec[i]);
+        return val;
+    }
+};
+
+template <typename T>
+using JsonTraitsOf = JsonTraits<typename std::decay<T>::type>;
+
+// 将参数按位置编码为json数组
+template <typename... Args>
+Json::Value packParams(const Args&... args) {
+    Json::Value params(Json::arrayValue);
+    params.resize(sizeof...(Args));
+    Json::ArrayIndex i = 0;
+    (void)i;
+    (void)std::initializer_list<int>{(params[i++] = JsonTraitsOf<Args>::to(args), 0)...};
+    return params;
+}
+
+}  // namespace myrpc
@@ -0,0 +1,63 @@
+#include "../client/rpc_client.hpp"
+#include "../server/rpc_server.hpp"
+#include <muduo/base/Logging.h>
+
+// 分片帧轮流发送：先发出一个8MB的调用，再发出一个小调用，
+// 小调用的帧插在大调用的分片帧之间发送，应先于大调用完成
+
+std::mutex order_mutex;
+std::vector<std::string> order;
+
+int main(int argc, char* argv[]){
+	muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+	if(argc != 2){
+		std::cout << "Usage: chunk [port]\n";
+		return 0;
+	}
+	int port = atoi(argv[1]);
+
+	auto server = std::make_shared<myrpc::server::RpcServer>(port);
+	server->registerMethod<std::string(std::string)>("Echo", [](const std::string& data){
+		return data;
+	}, {"data"});
+	server->registerMethod<int64_t(int64_t, int64_t)>("Add", [](int64_t num1, int64_t num2){
+		return num1 + num2;
+	}, {"num1", "num2"});
+	std::thread([server](){ server->start(); }).detach();
+	sleep(1);
+
+	auto client = std::make_shared<myrpc::client::RpcClient>("127.0.0.1", port);
+	if(client->peerSupports(myrpc::CAP_CHUNK) == false){
+		std::cout << "服务端不支持分片\n";
+		_exit(1);
+	}
+	auto record = [](const std::string& name, myrpc::RCode rcode){
+		std::unique_lock<std::mutex> lock(order_mutex);
+		order.push_back(rcode == myrpc::RCode::RCODE_OK ? name : name + "(" + myrpc::errReason(rcode) + ")");
+	};
+	Json::Value big, small;
+	big["data"] = std::string(8 << 20, 'x');
+	small["num1"] = 11;
+	small["num2"] = 22;
+	auto start = std::chrono::steady_clock::now();
+	client->asyncCall("Echo", big, [&](myrpc::RCode rcode, const Json::Value& result){
+		record("Echo", result.asString().size() == (8 << 20) ? rcode : myrpc::RCode::RCODE_INVALID_MSG);
+	});
+	client->asyncCall("Add", small, [&](myrpc::RCode rcode, const Json::Value& result){
+		record("Add", result.asInt64() == 33 ? rcode : myrpc::RCode::RCODE_INVALID_MSG);
+	});
+	while(true){
+		std::unique_lock<std::mutex> lock(order_mutex);
+		if(order.size() == 2) break;
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "完成顺序: " << order[0] << " " << order[1] << "，耗时 " << ms << "ms\n";
+	if(order[0] != "Add" || order[1] != "Echo"){
+		std::cout << "小调用没有先于大调用完成\n";
+		_exit(1);
+	}
+	_exit(0);
+}
@@ -0,0 +1,65 @@
+#include "../common/message.hpp"
+
+// 对比 JSON 与 BINARY 两种正文编码的序列化/反序列化开销
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+void bench(const std::string& name, const std::shared_ptr<T>& msg, int rounds){
+	for(auto codec : {myrpc::CodecType::JSON, myrpc::CodecType::BINARY}){
+		std::string body;
+		auto start = Clock::now();
+		for(int i = 0; i < rounds; i++){
+			body = msg->serialize(codec);
+		}
+		// 消息对象只构造一次，只统计正文编解码本身的开销
+		auto out = std::make_shared<T>();
+		auto mid = Clock::now();
+		for(int i = 0; i < rounds; i++){
+			if(out->unserialize(body, codec) == false || out->check() == false){
+				ELOG("%s 反序列化失败", name.c_str());
+				return;
+			}
+		}
+		auto end = Clock::now();
+		double enc = std::chrono::duration<double, std::nano>(mid - start).count() / rounds;
+		double dec = std::chrono::duration<double, std::nano>(end - mid).count() / rounds;
+		printf("%-16s %-7s %6zu bytes  encode %8.1f ns  decode %8.1f ns\n",
+			name.c_str(), codec == myrpc::CodecType::JSON ? "json" : "binary", body.size(), enc, dec);
+	}
+}
+
+int main(int argc, char* argv[]){
+
+	int rounds = 200000;
+	if(argc == 2){
+		rounds = atoi(argv[1]);
+	}
+
+	auto rpc_req = std::make_shared<myrpc::RpcRequest>();
+	rpc_req->setMethod("Add");
+	Json::Value params;
+	params["num1"] = 11;
+	params["num2"] = 22;
+	rpc_req->setParams(params);
+	bench("RpcRequest", rpc_req, rounds);
+
+	auto rpc_rsp = std::make_shared<myrpc::RpcResponse>();
+	rpc_rsp->setRCode(myrpc::RCode::RCODE_OK);
+	rpc_rsp->setResult(33);
+	bench("RpcResponse", rpc_rsp, rounds);
+
+	auto svc_req = std::make_shared<myrpc::ServiceRequest>();
+	svc_req->setMethod("Add");
+	svc_req->setOptype(myrpc::ServiceOptype::SERVICE_REGISTRY);
+	svc_req->setHost(std::make_pair(std::string("127.0.0.1"), 8080));
+	bench("ServiceRequest", svc_req, rounds);
+
+	auto svc_rsp = std::make_shared<myrpc::ServiceResponse>();
+	svc_rsp->setRCode(myrpc::RCode::RCODE_OK);
+	svc_rsp->setOptype(myrpc::ServiceOptype::SERVICE_RETURN);
+	svc_rsp->setIdleCount(128);
+	bench("ServiceResponse", svc_rsp, rounds);
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include "../client/rpc_coroutine.hpp"
+#include <muduo/base/Logging.h>
+
+// 协程方式调用Add服务：少量线程即可同时维持大量在途调用
+// 需要先启动 Add 服务端，以 -std=c++20 编译
+
+using myrpc::client::Task;
+
+Task<int64_t> add(myrpc::client::CoRpcClient* client, int64_t num1, int64_t num2){
+	Json::Value params;
+	params["num1"] = num1;
+	params["num2"] = num2;
+	auto [rcode, result] = co_await client->call("Add", params);
+	if(rcode != myrpc::RCode::RCODE_OK){
+		ELOG("调用失败：%s", myrpc::errReason(rcode).c_str());
+		co_return 0;
+	}
+	co_return result.asInt64();
+}
+
+// 每个worker顺序地发起rounds次调用，所有worker并发执行
+Task<> worker(myrpc::client::CoRpcClient* client, int id, int rounds, std::atomic<int64_t>* total, std::atomic<int>* running, std::promise<void>* done){
+	for(int i = 0; i < rounds; i++){
+		*total += co_await add(client, id, i);
+	}
+	if(running->fetch_sub(1) == 1){
+		done->set_value();
+	}
+}
+
+int main(int argc, char* argv[]){
+	muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+	if(argc != 5){
+		std::cout << "Usage: coroutine [ip] [port] [workers] [rounds]\n";
+		return 0;
+	}
+	std::string ip(argv[1]);
+	int port = atoi(argv[2]);
+	int workers = atoi(argv[3]);
+	int rounds = atoi(argv[4]);
+	auto client = std::make_shared<myrpc::client::CoRpcClient>(ip, port);
+
+	std::atomic<int64_t> total(0);
+	std::atomic<int> running(workers);
+	std::promise<void> done;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < workers; i++){
+		worker(client.get(), i, rounds, &total, &running, &done).start();
+	}
+	done.get_future().wait();
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "calls: " << (int64_t)workers * rounds << " total: " << total << " time: " << ms << "ms\n";
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include "../client/rpc_hedge.hpp"
+#include "../server/rpc_server.hpp"
+#include "../server/service_registry.hpp"
+#include <muduo/base/Logging.h>
+
+// 对冲调用：进程内启动注册中心与两个提供Add服务的主机，服务发现分配的主机变慢后，
+// 对冲请求经注册中心的主机列表发往另一台主机并先返回
+
+std::atomic<int> slow_port(0);
+
+int main(int argc, char* argv[]){
+	muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+	if(argc != 4){
+		std::cout << "Usage: hedge [rport] [port1] [port2]\n";
+		return 0;
+	}
+	int rport = atoi(argv[1]);
+	int ports[2] = {atoi(argv[2]), atoi(argv[3])};
+
+	auto registry = std::make_shared<myrpc::server::ServiceRegistry>(rport);
+	std::thread([registry](){ registry->start(); }).detach();
+	for(int port : ports){
+		auto server = std::make_shared<myrpc::server::RpcServer>(port);
+		// slow_port对应的主机每次调用耗时200ms
+		server->registerMethod<int64_t(int64_t, int64_t)>("Add", [port](int64_t num1, int64_t num2){
+			if(slow_port.load() == port) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			return num1 + num2;
+		}, {"num1", "num2"});
+		std::thread([server](){ server->start(); }).detach();
+	}
+	sleep(1);
+
+	auto provider = std::make_shared<myrpc::client::Provider>("127.0.0.1", rport);
+	for(int port : ports){
+		provider->registryMethod("Add", std::make_pair(std::string("127.0.0.1"), port));
+	}
+
+	auto discoverer = std::make_shared<myrpc::client::Discoverer>("127.0.0.1", rport);
+	auto hedge = myrpc::client::HedgedRpcClient::create(discoverer);
+	hedge->setHedgeDelay(20);
+	myrpc::Address primary;
+	if(discoverer->discover("Add", primary) == false){
+		std::cout << "服务发现失败\n";
+		return 1;
+	}
+	slow_port = primary.second;
+	std::cout << "服务发现分配的主机 " << primary.first << ":" << primary.second << " 变慢\n";
+
+	// 第一次对冲时才在后台连接另一台主机，之后的对冲请求都发往它
+	int failed = 0;
+	for(int i = 0; i < 20; i++){
+		Json::Value params, result;
+		params["num1"] = i;
+		params["num2"] = 1;
+		if(hedge->call("Add", params, result) == false || result.asInt64() != i + 1){
+			failed++;
+		}
+	}
+	auto st = hedge->stats();
+	std::cout << "calls: " << st.calls << " failed: " << failed << " hedged: " << st.hedged
+			  << " hedge_wins: " << st.hedge_wins << "\n";
+	if(failed > 0 || st.hedge_wins == 0){
+		std::cout << "对冲请求没有到达另一台主机\n";
+		_exit(1);
+	}
+	_exit(0);
+}
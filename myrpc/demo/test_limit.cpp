@@ -0,0 +1,64 @@
+#include "../client/rpc_client.hpp"
+#include "../server/rpc_server.hpp"
+#include <muduo/base/Logging.h>
+
+// 并发限制与批量调用：Slow方法的并发上限为2，两个调用占满额度时，
+// 批量请求中的Slow调用以RCODE_OVERLOADED返回，同一批中的其他调用照常执行
+
+std::atomic<bool> release(false);
+
+int main(int argc, char* argv[]){
+	muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+	if(argc != 2){
+		std::cout << "Usage: limit [port]\n";
+		return 0;
+	}
+	int port = atoi(argv[1]);
+
+	auto server = std::make_shared<myrpc::server::RpcServer>(port);
+	server->registerMethod<int64_t(int64_t)>("Slow", [](int64_t num){
+		while(release.load() == false) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return num;
+	}, {"num"});
+	server->registerMethod<int64_t(int64_t, int64_t)>("Add", [](int64_t num1, int64_t num2){
+		return num1 + num2;
+	}, {"num1", "num2"});
+	server->enableConcurrencyLimit("Slow", myrpc::server::ConcurrencyLimiter::defaultTargetQueueMs, 2);
+	std::thread([server](){ server->start(); }).detach();
+	sleep(1);
+
+	auto client = std::make_shared<myrpc::client::RpcClient>("127.0.0.1", port);
+	std::future<std::pair<myrpc::RCode, int64_t>> slow[2];
+	for(int i = 0; i < 2; i++){
+		client->asyncCall<int64_t>("Slow", slow[i], (int64_t)i);
+	}
+	// 等两个Slow调用到达服务端后再放行
+	std::thread([](){
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		release = true;
+	}).detach();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	Json::Value slow_params, add_params;
+	slow_params["num"] = 2;
+	add_params["num1"] = 11;
+	add_params["num2"] = 22;
+	std::vector<std::pair<myrpc::RCode, Json::Value>> results;
+	if(client->batchCall({{"Slow", slow_params}, {"Add", add_params}}, results) == false){
+		std::cout << "批量调用失败\n";
+		_exit(1);
+	}
+	std::cout << "Slow: " << myrpc::errReason(results[0].first) << " Add: " << results[1].second.asInt64() << "\n";
+	for(auto& f : slow){
+		if(f.get().first != myrpc::RCode::RCODE_OK){
+			std::cout << "占用额度的调用失败\n";
+			_exit(1);
+		}
+	}
+	if(results[0].first != myrpc::RCode::RCODE_OVERLOADED || results[1].first != myrpc::RCode::RCODE_OK || results[1].second.asInt64() != 33){
+		std::cout << "批量请求没有按并发上限拒绝\n";
+		_exit(1);
+	}
+	_exit(0);
+}
@@ -0,0 +1,44 @@
+#include "../client/rpc_pool.hpp"
+#include <muduo/base/Logging.h>
+
+// 多个线程通过连接池调用Add服务，连接数越多越能利用服务端的多个io线程
+// 需要先启动 Add 服务端
+
+int main(int argc, char* argv[]){
+	muduo::Logger::setLogLevel(muduo::Logger::WARN);
+
+	if(argc != 6){
+		std::cout << "Usage: pool [ip] [port] [connections] [threads] [rounds]\n";
+		return 0;
+	}
+	std::string ip(argv[1]);
+	int port = atoi(argv[2]);
+	int connections = atoi(argv[3]);
+	int threads = atoi(argv[4]);
+	int rounds = atoi(argv[5]);
+	auto pool = myrpc::client::RpcClientPool::create(ip, port, connections);
+
+	std::atomic<int> failed(0);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threads; t++){
+		workers.emplace_back([&, t](){
+			Json::Value params, result;
+			for(int i = 0; i < rounds; i++){
+				params["num1"] = t;
+				params["num2"] = i;
+				if(pool->call("Add", params, result) == false || result.asInt() != t + i){
+					failed++;
+				}
+			}
+		});
+	}
+	for(auto& worker : workers){
+		worker.join();
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "calls: " << (int64_t)threads * rounds << " failed: " << failed
+			  << " qps: " << (int64_t)(threads * rounds / sec) << "\n";
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include "../common/thread_poll.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+
+// 对比单队列线程池与工作窃取线程池：多个提交线程(模拟io线程)提交大量极小的任务(模拟小请求)
+// 与rpc服务端一样，每个提交线程同时未完成的任务数有上限(模拟连接上的在途请求)，队列不会无限增长
+// 任务捕获的内容与rpc请求的任务大小相当(连接、请求、方法描述等几个智能指针)
+
+using Clock = std::chrono::steady_clock;
+
+// 改造前的线程池：所有线程共用一个队列、一把锁与一个条件变量
+class SingleQueuePool {
+public:
+	SingleQueuePool(size_t threads) : stop(false) {
+		for (size_t i = 0; i < threads; ++i) {
+			workers.emplace_back([this] {
+				while (true) {
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(queue_mutex);
+						condition.wait(lock, [this] { return stop || !tasks.empty(); });
+						if (stop && tasks.empty()) return;
+						task = std::move(tasks.front());
+						tasks.pop();
+					}
+					task();
+				}
+			});
+		}
+	}
+	~SingleQueuePool() {
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			stop = true;
+		}
+		condition.notify_all();
+		for (std::thread &worker : workers) worker.join();
+	}
+	void enqueue(std::function<void()> task) {
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			tasks.emplace(std::move(task));
+		}
+		condition.notify_one();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queue_mutex;
+	std::condition_variable condition;
+	bool stop;
+};
+
+static const int maxInFlight = 256;
+
+template <typename Pool>
+double bench(size_t threads, int producers, int tasks) {
+	std::atomic<long> done(0);
+	auto start = Clock::now();
+	{
+		Pool pool(threads);
+		std::vector<std::thread> submitters;
+		for (int p = 0; p < producers; p++) {
+			submitters.emplace_back([&pool, &done, tasks]() {
+				std::atomic<int> in_flight(0);
+				auto conn = std::make_shared<int>(0), request = std::make_shared<int>(0), service = std::make_shared<int>(0);
+				auto permit = std::make_shared<int>(0), token = std::make_shared<int>(0);
+				for (int i = 0; i < tasks; i++) {
+					while (in_flight.load(std::memory_order_relaxed) >= maxInFlight) {
+						std::this_thread::yield();
+					}
+					in_flight.fetch_add(1, std::memory_order_relaxed);
+					auto task = [&done, &in_flight, conn, request, service, permit, token]() {
+						done.fetch_add(1, std::memory_order_relaxed);
+						in_flight.fetch_sub(1, std::memory_order_relaxed);
+					};
+					static_assert(myrpc::Task::storedInline<decltype(task)>(), "任务应当内联存放");
+					pool.enqueue(std::move(task));
+				}
+				while (in_flight.load() > 0) {
+					std::this_thread::yield();
+				}
+			});
+		}
+		for (auto &submitter : submitters) submitter.join();
+	}  // 析构时等待所有任务执行完毕
+	double sec = std::chrono::duration<double>(Clock::now() - start).count();
+	if (done.load() != (long)producers * tasks) {
+		printf("任务数量不一致！\n");
+	}
+	return producers * tasks / sec;
+}
+
+int main(int argc, char *argv[]) {
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	int tasks = argc > 2 ? atoi(argv[2]) : 500000;
+	size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	printf("提交线程 %d，每个线程提交 %d 个任务\n", producers, tasks);
+	if (cores == 1) {
+		printf("只有一个cpu核心，结果只反映单核上的开销，不能说明多核上的扩展性\n");
+	}
+	for (size_t threads = 1; threads <= cores; threads *= 2) {
+		double single = bench<SingleQueuePool>(threads, producers, tasks);
+		double stealing = bench<myrpc::ThreadPool>(threads, producers, tasks);
+		printf("工作线程 %2zu  单队列 %10.0f 任务/秒  工作窃取 %10.0f 任务/秒\n", threads, single, stealing);
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+namespace myrpc {
+namespace server {
+
+// 自适应并发限制：同时在处理(排队+执行)的请求数超过上限时直接拒绝，让过载表现为快速失败而不是越来越长的延迟
+// 上限按请求的排队时间调整：一个统计周期内平均排队时间超过目标值时按比例减小，上限被用满且排队时间正常时逐步增大
+class ConcurrencyLimiter {
+   public:
+    using ptr = std::shared_ptr<ConcurrencyLimiter>;
+    struct Stats {
+        size_t limit = 0;
+        size_t inflight = 0;
+        size_t rejected = 0;
+        int64_t queue_us = 0;  // 最近一个统计周期的平均排队时间
+    };
+    static constexpr int defaultTargetQueueMs = 5;
+    static constexpr size_t defaultMaxLimit = 1000;
+
+    ConcurrencyLimiter(int target_queue_ms = defaultTargetQueueMs, size_t max_limit = defaultMaxLimit)
+        : _target_us((target_queue_ms > 0 ? target_queue_ms : defaultTargetQueueMs) * 1000),
+          _max_limit(std::max(max_limit, minLimit)),
+          _value(std::min<double>(initialLimit, _max_limit)),
+          _limit((size_t)_value) {}
+
+    // 占用一个额度，超过上限时返回false
+    bool acquire() {
+        size_t limit = _limit.load(std::memory_order_relaxed);
+        size_t inflight = _inflight.fetch_add(1) + 1;
+        if (inflight > limit) {
+            _inflight.fetch_sub(1);
+            _rejected.fetch_add(1, std::memory_order_relaxed);
+            _saturated.store(true, std::memory_order_relaxed);
+            return false;
+        }
+        if (inflight == limit) {
+            _saturated.store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    // 归还额度，queue_us为请求的排队时间，小于0表示请求没有执行，不计入统计
+    // 样本只累加到原子计数中，只有结束统计周期的线程加锁调整上限，其他线程不会在锁上等待
+    void release(int64_t queue_us) {
+        _inflight.fetch_sub(1);
+        if (queue_us < 0) {
+            return;
+        }
+        _window_sum.fetch_add(queue_us, std::memory_order_relaxed);
+        size_t count = _window_count.fetch_add(1, std::memory_order_relaxed) + 1;
+        int64_t now = nowUs();
+        if (count < windowSamples && now - _window_start.load(std::memory_order_relaxed) < windowMs * 1000) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+        if (lock.owns_lock() == false) {
+            return;  // 其他线程正在结束这个统计周期
+        }
+        // 加锁前其他线程可能刚结束了统计周期，需要重新判断
+        count = _window_count.load(std::memory_order_relaxed);
+        if (count == 0 || (count < windowSamples && now - _window_start.load(std::memory_order_relaxed) < windowMs * 1000)) {
+            return;
+        }
+        count = _window_count.exchange(0, std::memory_order_relaxed);
+        int64_t avg = _window_sum.exchange(0, std::memory_order_relaxed) / (int64_t)count;
+        _window_start.store(now, std::memory_order_relaxed);
+        if (avg > _target_us) {
+            _value = std::max<double>(minLimit, _value * backoffRatio);
+        } else if (_saturated.load(std::memory_order_relaxed)) {
+            _value = std::min<double>(_max_limit, _value + std::max(1.0, std::sqrt(_value)));
+        }
+        _limit.store((size_t)_value, std::memory_order_relaxed);
+        _queue_us.store(avg, std::memory_order_relaxed);
+        _saturated.store(false, std::memory_order_relaxed);
+    }
+    Stats stats() {
+        Stats st;
+        st.limit = _limit.load(std::memory_order_relaxed);
+        st.inflight = _inflight.load();
+        st.rejected = _rejected.load(std::memory_order_relaxed);
+        st.queue_us = _queue_us.load(std::memory_order_relaxed);
+        return st;
+    }
+
+   private:
+    static constexpr size_t minLimit = 1;
+    static constexpr size_t initialLimit = 64;
+    static constexpr size_t windowSamples = 64;  // 样本数或时长先达到时结束一个统计周期
+    static constexpr int windowMs = 100;
+    static constexpr double backoffRatio = 0.9;
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t _target_us;
+    size_t _max_limit;
+    std::mutex _mutex;  // 只在结束统计周期时持有
+    double _value;  // 上限的精确值，按整数部分限制
+    std::atomic<size_t> _limit;
+    std::atomic<size_t> _inflight{0};
+    std::atomic<size_t> _rejected{0};
+    std::atomic<bool> _saturated{false};  // 本周期内是否用满过上限，没有用满时增大上限没有意义
+    std::atomic<int64_t> _window_sum{0};
+    std::atomic<size_t> _window_count{0};
+    std::atomic<int64_t> _window_start{nowUs()};
+    std::atomic<int64_t> _queue_us{0};
+};
+
+// 一个被放行的请求占用的额度：开始执行时记录排队时间，最后一个持有者释放时归还额度
+class LimiterPermit {
+   public:
+    using ptr = std::shared_ptr<LimiterPermit>;
+    LimiterPermit(const ConcurrencyLimiter::ptr& server, const ConcurrencyLimiter::ptr& method)
+        : _server(server), _method(method), _admitted(std::chrono::steady_clock::now()) {}
+    ~LimiterPermit() {
+        if (_state.load() != RELEASED) release(_queue_us);
+    }
+    // 请求开始执行，记录排队时间
+    void begin() {
+        int state = QUEUED;
+        if (_state.compare_exchange_strong(state, RUNNING)) {
+            _queue_us = queuedUs();
+        }
+    }
+    // 排队中的请求被取消时立即归还额度，不必等到出队；已开始执行的请求仍占用线程，执行结束时才归还
+    void cancel() {
+        int state = QUEUED;
+        if (_state.compare_exchange_strong(state, RELEASED)) {
+            release(queuedUs());
+        }
+    }
+
+   private:
+    enum { QUEUED = 0, RUNNING, RELEASED };
+    int64_t queuedUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _admitted).count();
+    }
+    void release(int64_t queue_us) {
+        if (_server) _server->release(queue_us);
+        if (_method) _method->release(queue_us);
+    }
+
+    ConcurrencyLimiter::ptr _server;
+    ConcurrencyLimiter::ptr _method;
+    std::chrono::steady_clock::time_point _admitted;
+    int64_t _queue_us = -1;
+    std::atomic<int> _state{QUEUED};
+};
+
+}  // namespace server
+}  // namespace myrpc
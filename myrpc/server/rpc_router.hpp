@@ -1,7 +1,10 @@
 #pragma once
+#include <algorithm>
 #include "../common/message.hpp"
 #include "../common/net.hpp"
 #include "../common/thread_poll.hpp"
+#include "../common/traits.hpp"
+#include "rpc_limiter.hpp"
 
 namespace myrpc {
 namespace server {
@@ -14,16 +17,117 @@ enum class VType {
     ARRAY,
     OBJECT,
 };
+// 取消标记：客户端发送取消帧后置位
+using CancelToken = std::shared_ptr<std::atomic<bool>>;
+
+// 异步方法的应答器：业务回调保存应答器后即可返回，之后在任意线程中通过reply或fail发送响应
+// 每个请求只能应答一次；应答器释放时仍未应答的请求以RCODE_INTERNAL_ERROR响应，调用方不会一直等待
+class Responder {
+   public:
+    using ptr = std::shared_ptr<Responder>;
+    using SendCallback = std::function<void(RCode, const Json::Value&)>;
+    Responder(const SendCallback& send, const CancelToken& token) : _send(send), _token(token) {}
+    ~Responder() {
+        if (_replied.load() == false) {
+            ELOG("异步方法没有应答，按内部错误响应！");
+            _send(RCode::RCODE_INTERNAL_ERROR, Json::Value());
+        }
+    }
+    bool reply(const Json::Value& result) {
+        return finish(RCode::RCODE_OK, result);
+    }
+    bool fail(RCode rcode) {
+        return finish(rcode, Json::Value());
+    }
+    // 客户端已取消该请求，应答会被丢弃，业务可以提前结束
+    bool cancelled() {
+        return _token && _token->load(std::memory_order_relaxed);
+    }
+
+   private:
+    bool finish(RCode rcode, const Json::Value& result) {
+        if (_replied.exchange(true)) {
+            ELOG("异步方法重复应答！");
+            return false;
+        }
+        _send(rcode, result);
+        return true;
+    }
+
+    SendCallback _send;
+    CancelToken _token;
+    std::atomic<bool> _replied{false};
+};
+
+// 工作线程池及其排队上限：方法可以绑定到独立的线程池上，慢方法或热点方法排满自己的队列时不影响其他方法
+class WorkerPool {
+   public:
+    using ptr = std::shared_ptr<WorkerPool>;
+    // max_queue为排队等待执行的任务数上限，0表示不限制
+    WorkerPool(const std::string& name, size_t threads, size_t max_queue = 0)
+        : _name(name), _max_queue(max_queue), _pool(std::make_shared<ThreadPool>(threads)) {}
+    // 排队的任务数已达上限时返回false，任务不会执行
+    template <typename F>
+    bool tryEnqueue(F&& task) {
+        size_t max_queue = _max_queue.load();
+        if (_queued.fetch_add(1) >= max_queue && max_queue != 0) {
+            _queued.fetch_sub(1);
+            return false;
+        }
+        auto counted = [this, task = std::forward<F>(task)]() mutable {
+            _queued.fetch_sub(1);
+            task();
+        };
+        static_assert(Task::storedInline<decltype(counted)>(), "rpc任务超出了Task的内联存储，每个请求都会分配内存");
+        _pool->enqueue(std::move(counted));
+        return true;
+    }
+    // 不受排队上限限制
+    template <typename F>
+    void enqueue(F&& task) {
+        static_assert(Task::storedInline<F>(), "任务超出了Task的内联存储，每次提交都会分配内存");
+        _pool->enqueue(std::forward<F>(task));
+    }
+    void setMaxQueue(size_t max_queue) {
+        _max_queue = max_queue;
+    }
+    const std::string& name() { return _name; }
+    size_t threads() { return _pool->getThreadNum(); }
+    size_t queued() { return _queued.load(); }
+
+   private:
+    std::string _name;
+    std::atomic<size_t> _max_queue;
+    std::atomic<size_t> _queued{0};  // 已提交但还未开始执行的任务数
+    ThreadPool::ptr _pool;           // 最后声明、最先析构，析构时执行剩余任务仍可使用计数器
+};
+
 class MethodDescribe {
    public:
     using ptr = std::shared_ptr<MethodDescribe>;
     using MethodCallback = std::function<void(const Json::Value&, Json::Value&)>;  //参数  结果
+    // 异步方法：回调返回后不发送响应，由应答器在处理完成时发送
+    using AsyncCallback = std::function<void(const Json::Value&, const Responder::ptr&)>;
+    // 由模板生成的调用器，参数提取、校验与结果编码一次完成
+    using TypedCallback = std::function<RCode(const Json::Value&, Json::Value&)>;
     using ParamsDescribe = std::pair<std::string, VType>;
     MethodDescribe(std::string&& mname, std::vector<ParamsDescribe>&& desc, VType vtype, MethodCallback&& handler, bool use_io_thread = false)
         : _method_name(std::move(mname)), _callback(std::move(handler)), _params_desc(std::move(desc)), _return_type(vtype), _use_io_thread(use_io_thread) {}
+    MethodDescribe(std::string&& mname, std::vector<ParamsDescribe>&& desc, VType vtype, AsyncCallback&& handler, bool use_io_thread = false)
+        : _method_name(std::move(mname)), _async_callback(std::move(handler)), _params_desc(std::move(desc)), _return_type(vtype), _use_io_thread(use_io_thread) {}
+    MethodDescribe(std::string&& mname, TypedCallback&& invoker, bool use_io_thread = false)
+        : _method_name(std::move(mname)), _typed_callback(std::move(invoker)), _return_type(VType::OBJECT), _use_io_thread(use_io_thread) {}
     const std::string& method() { return _method_name; }
     // 针对收到的请求中的参数进行校验
     bool paramCheck(const Json::Value& params) {
+        // 类型化方法在调用时完成校验
+        if (_typed_callback) {
+            return params.isObject() || params.isArray();
+        }
+        if (params.isObject() == false) {
+            ELOG("参数不是对象类型！");
+            return false;
+        }
         // 对params进行参数校验---判断所描述的参数字段是否存在，类型是否一致
         for (auto& desc : _params_desc) {
             if (params.isMember(desc.first) == false) {
@@ -37,19 +141,68 @@ class MethodDescribe {
         }
         return true;
     }
-    bool call(const Json::Value& params, Json::Value& result) {
+    RCode call(const Json::Value& params, Json::Value& result) {
+        if (_typed_callback) {
+            return _typed_callback(params, result);
+        }
 		_callback(params, result);
-		std::string res_json;
-		myrpc::JSON::serialize(result, res_json);
         if (rtypeCheck(result) == false) {
             ELOG("回调处理函数中的响应信息校验失败！");
-            return false;
+            return RCode::RCODE_INTERNAL_ERROR;
         }
-        return true;
+        return RCode::RCODE_OK;
     }
 	bool useIOThread() {
 		return _use_io_thread;
 	}
+	// 方法绑定的工作线程池名称，为空时使用默认线程池
+	const std::string& pool() {
+		return _pool;
+	}
+	void setPool(const std::string& pool) {
+		_pool = pool;
+	}
+	bool isAsync() {
+		return (bool)_async_callback;
+	}
+	void callAsync(const Json::Value& params, const Responder::ptr& responder) {
+		_async_callback(params, responder);
+	}
+	// 异步方法应答时校验结果类型
+	bool resultCheck(const Json::Value& result) {
+		return rtypeCheck(result);
+	}
+	// 自适应调度：按执行耗时的指数加权平均决定在io线程中直接执行，还是交给工作线程
+	// 指定了io线程、绑定了线程池的方法与异步方法的执行位置是固定的，不参与
+	bool adaptive() {
+		return _use_io_thread == false && _pool.empty() && isAsync() == false;
+	}
+	bool runInline() {
+		return _run_inline.load(std::memory_order_relaxed);
+	}
+	int64_t avgCostUs() {
+		return _avg_cost_ns.load(std::memory_order_relaxed) / 1000;
+	}
+	// 记录一次执行耗时，返回执行位置是否发生变化
+	// 平均耗时足够小且样本足够多时改为在io线程中执行；在io线程中平均耗时变大或单次耗时过长时立即退回工作线程
+	// 多个工作线程同时记录时可能丢失个别样本，对平均值影响可以忽略
+	bool recordCost(int64_t ns) {
+		int64_t avg = _avg_cost_ns.load(std::memory_order_relaxed);
+		avg = _samples.load(std::memory_order_relaxed) == 0 ? ns : avg + (ns - avg) / ewmaWeight;
+		_avg_cost_ns.store(avg, std::memory_order_relaxed);
+		size_t samples = _samples.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (runInline()) {
+			if (avg > demoteCostNs || ns > slowCallNs) {
+				_run_inline.store(false, std::memory_order_relaxed);
+				_samples.store(0, std::memory_order_relaxed);  // 重新积累样本后才能再次进入io线程
+				return true;
+			}
+		} else if (samples >= minSamples && avg < inlineCostNs) {
+			_run_inline.store(true, std::memory_order_relaxed);
+			return true;
+		}
+		return false;
+	}
 
    private:
     bool rtypeCheck(const Json::Value& val) {
@@ -76,9 +229,20 @@ class MethodDescribe {
    private:
     std::string _method_name;                  // 方法名称
     MethodCallback _callback;                 // 实际的业务回调函数
+    TypedCallback _typed_callback;             // 类型化方法的调用器
+    AsyncCallback _async_callback;             // 异步方法的业务回调
     std::vector<ParamsDescribe> _params_desc;  // 参数字段格式描述
     VType _return_type;                        // 结果作为返回值类型的描述
 	bool _use_io_thread; 				       // 是否使用io线程
+	std::string _pool;                         // 绑定的工作线程池
+	static constexpr int64_t ewmaWeight = 8;
+	static constexpr size_t minSamples = 64;
+	static constexpr int64_t inlineCostNs = 20 * 1000;   // 平均耗时低于该值时在io线程中执行
+	static constexpr int64_t demoteCostNs = 100 * 1000;  // 两个阈值之间留出余量，避免来回切换
+	static constexpr int64_t slowCallNs = 1000 * 1000;
+	std::atomic<bool> _run_inline{false};      // 自适应调度的当前执行位置
+	std::atomic<int64_t> _avg_cost_ns{0};
+	std::atomic<size_t> _samples{0};
 };
 
 class SDescribeFactory {
@@ -95,20 +259,87 @@ class SDescribeFactory {
     void setCallback(const MethodDescribe::MethodCallback& cb) {
         _callback = cb;
     }
+	// 注册异步方法：回调保存responder后即可返回，不占用工作线程等待下游调用或磁盘io
+	// 处理完成后在任意线程中调用responder->reply(result)或responder->fail(rcode)
+	void setAsyncCallback(const MethodDescribe::AsyncCallback& cb) {
+		_async_callback = cb;
+	}
+	// 以函数签名注册类型化的回调，如 setTypedCallback<int64_t(int64_t, int64_t)>(Add, {"num1", "num2"})
+	// 参数既可以按names中的字段名传递(对象)，也可以按位置传递(数组)；names为空时只接受按位置传递
+	template <typename Sig, typename F>
+	bool setTypedCallback(F&& fn, const std::vector<std::string>& names = {}) {
+		return TypedInvoker<Sig>::make(std::function<Sig>(std::forward<F>(fn)), names, _typed_callback);
+	}
 	void setUseIOThread(bool use_io_thread) {
 		_use_io_thread = use_io_thread;
 	}
+	// 绑定到RpcServer::addPool创建的工作线程池上
+	void setPool(const std::string& pool) {
+		_pool = pool;
+	}
     MethodDescribe::ptr build() {
-        return std::make_shared<MethodDescribe>(std::move(_method_name),
-                                                 std::move(_params_desc), _return_type, std::move(_callback), _use_io_thread);
+        MethodDescribe::ptr desc;
+        if (_typed_callback) {
+            desc = std::make_shared<MethodDescribe>(std::move(_method_name), std::move(_typed_callback), _use_io_thread);
+        } else if (_async_callback) {
+            desc = std::make_shared<MethodDescribe>(std::move(_method_name),
+                                                     std::move(_params_desc), _return_type, std::move(_async_callback), _use_io_thread);
+        } else {
+            desc = std::make_shared<MethodDescribe>(std::move(_method_name),
+                                                     std::move(_params_desc), _return_type, std::move(_callback), _use_io_thread);
+        }
+        desc->setPool(_pool);
+        return desc;
     }
 
    private:
+    template <typename Sig>
+    struct TypedInvoker;
+    template <typename R, typename... Args>
+    struct TypedInvoker<R(Args...)> {
+        static_assert(!std::is_void<R>::value, "rpc方法必须有返回值");
+        static bool make(std::function<R(Args...)>&& fn, const std::vector<std::string>& names, MethodDescribe::TypedCallback& invoker) {
+            if (names.empty() == false && names.size() != sizeof...(Args)) {
+                ELOG("参数名称数量与函数签名不一致！");
+                return false;
+            }
+            invoker = [fn = std::move(fn), names](const Json::Value& params, Json::Value& result) {
+                return invoke(fn, names, params, result, std::index_sequence_for<Args...>());
+            };
+            return true;
+        }
+        template <size_t... I>
+        static RCode invoke(const std::function<R(Args...)>& fn, const std::vector<std::string>& names,
+                            const Json::Value& params, Json::Value& result, std::index_sequence<I...>) {
+            const Json::Value* args[sizeof...(Args) + 1] = {arg(params, names, I)...};
+            bool valid = true;
+            (void)std::initializer_list<int>{(valid = valid && args[I] && JsonTraitsOf<Args>::check(*args[I]), 0)...};
+            if (valid == false) {
+                ELOG("类型化方法参数校验失败！");
+                return RCode::RCODE_INVALID_PARAMS;
+            }
+            result = JsonTraits<R>::to(fn(JsonTraitsOf<Args>::as(*args[I])...));
+            return RCode::RCODE_OK;
+        }
+        static const Json::Value* arg(const Json::Value& params, const std::vector<std::string>& names, size_t i) {
+            if (params.isArray()) {
+                return i < params.size() ? &params[(Json::ArrayIndex)i] : nullptr;
+            }
+            if (params.isObject() && i < names.size()) {
+                return params.find(names[i].data(), names[i].data() + names[i].size());
+            }
+            return nullptr;
+        }
+    };
+
     std::string _method_name;
     MethodDescribe::MethodCallback _callback;                 // 实际的业务回调函数
+    MethodDescribe::TypedCallback _typed_callback;            // 类型化方法的调用器
+    MethodDescribe::AsyncCallback _async_callback;            // 异步方法的业务回调
     std::vector<MethodDescribe::ParamsDescribe> _params_desc;  // 参数字段格式描述
     VType _return_type;                                         // 结果作为返回值类型的描述
 	bool _use_io_thread = false;  // 是否使用io线程
+	std::string _pool;            // 绑定的工作线程池
 };
 
 class ServiceManager {
@@ -130,21 +361,114 @@ class ServiceManager {
         std::unique_lock<std::mutex> lock(_mutex);
         _services.erase(method_name);
     }
+    std::vector<MethodDescribe::ptr> methods() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::vector<MethodDescribe::ptr> descs;
+        for (auto& it : _services) {
+            descs.push_back(it.second);
+        }
+        return descs;
+    }
 
    private:
     std::mutex _mutex;
     std::unordered_map<std::string, MethodDescribe::ptr> _services;
 };
 
+// 当前线程正在执行的rpc调用的上下文，耗时较长的业务回调可以据此提前结束已被取消的调用
+// if (myrpc::server::CallContext::cancelled()) return;
+class CallContext {
+   public:
+    static bool cancelled() {
+        return _token && _token->load(std::memory_order_relaxed);
+    }
+
+   private:
+    friend class RpcRouter;
+    // 在调用期间设置当前线程的取消标记，结束后恢复
+    class Scope {
+       public:
+        Scope(const CancelToken& token) : _prev(_token) { _token = token.get(); }
+        ~Scope() { _token = _prev; }
+
+       private:
+        std::atomic<bool>* _prev;
+    };
+    static inline thread_local std::atomic<bool>* _token = nullptr;
+};
+
+// 取消标记表：按(连接编号, 请求id)索引，不同连接的请求id可能相同
+// 异步方法的应答可能在路由器释放之后才发生，应答器持有标记表的共享指针，不引用路由器本身
+class CancelTable {
+   public:
+    using ptr = std::shared_ptr<CancelTable>;
+    using Key = std::pair<uint64_t, RequestId>;
+    // permit为请求在排队期间占用的并发额度，取消时立即归还；只保存弱引用，不延长额度的占用时间
+    CancelToken add(const Key& key, const LimiterPermit::ptr& permit = LimiterPermit::ptr()) {
+        auto token = std::make_shared<std::atomic<bool>>(false);
+        Shard& shard = shardOf(key);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.tokens[key] = Entry{token, permit};
+        return token;
+    }
+    void remove(const Key& key) {
+        Shard& shard = shardOf(key);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        shard.tokens.erase(key);
+    }
+    // 置位请求的取消标记，请求已结束或不可取消时返回false
+    bool cancel(const Key& key) {
+        Shard& shard = shardOf(key);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.tokens.find(key);
+        if (it == shard.tokens.end()) {
+            return false;
+        }
+        it->second.token->store(true);
+        auto permit = it->second.permit.lock();
+        lock.unlock();
+        if (permit) permit->cancel();
+        return true;
+    }
+
+   private:
+    struct Entry {
+        CancelToken token;
+        std::weak_ptr<LimiterPermit> permit;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<uint64_t>()(key.first * 0x9e3779b97f4a7c15ULL ^ key.second);
+        }
+    };
+    // 按键分片，各个io线程与工作线程登记和移除标记时不争用同一把锁
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> tokens;
+    };
+    Shard& shardOf(const Key& key) {
+        return _shards[KeyHash()(key) % shardCount];
+    }
+    static const size_t shardCount = 16;
+    Shard _shards[shardCount];
+};
+
 class RpcRouter {
    public:
     using ptr = std::shared_ptr<RpcRouter>;
+    // 方法当前的执行位置
+    struct Placement {
+        bool io_thread = false;  // 是否在io线程中执行
+        bool adaptive = false;   // 执行位置是否由自适应调度决定
+        int64_t avg_cost_us = 0; // 自适应调度统计的平均执行耗时
+    };
     RpcRouter(size_t numThreads = 0)
         : _service_manager(std::make_shared<ServiceManager>()),
-		  _thread_pool(std::make_shared<ThreadPool>(numThreads)) {}
+		  _tokens(std::make_shared<CancelTable>()),
+		  _thread_pool(std::make_shared<WorkerPool>("", numThreads)) {}
     // 这是注册到Dispatcher模块针对rpc请求进行回调处理的业务函数
     void onRpcRequest(const BaseConnection::ptr& conn, RpcRequest::ptr& request) {
-		DLOG("收到rpc请求 rid=%s", request->rid().c_str());
+		DLOG("收到rpc请求 rid=%lu", request->rid());
         // 1. 查询客户端请求的方法描述--判断当前服务端能否提供对应的服务
         auto service = _service_manager->select(request->method());
         if (service.get() == nullptr) {
@@ -156,30 +480,407 @@ class RpcRouter {
             ELOG("%s 服务参数校验失败！", request->method().c_str());
             return response(conn, request, Json::Value(), RCode::RCODE_INVALID_PARAMS);
         }
-		auto call = [this, service, request, conn](bool inLoop) {
-			// 3. 调用业务回调接口进行业务处理
-			Json::Value result;
-			bool ret = service->call(request->params(), result);
-			if (ret == false) {
-				ELOG("%s 服务返回参数校验失败！", request->method().c_str());
-				return response(conn, request, Json::Value(), RCode::RCODE_INTERNAL_ERROR, inLoop);
+		// 超过并发上限的请求立即拒绝，客户端可以稍后重试或换一个主机
+		LimiterPermit::ptr permit;
+		if (admit(service, permit) == false) {
+			DLOG("%s 超过并发上限，拒绝请求 rid=%lu", request->method().c_str(), request->rid());
+			return response(conn, request, Json::Value(), RCode::RCODE_OVERLOADED, true);
+		}
+		// 请求带有超时时间时，调用方在截止时刻之后不再等待响应，排队过久的请求直接丢弃
+		Deadline deadline = deadlineOf(request->timeout());
+		// 并发额度在call销毁时归还；异步方法交给应答器后即归还，等待下游的时间不占用额度
+		// 取消标记在请求结束时移除，交给异步方法应答器的请求在应答时移除
+		auto call = [this, service, request, conn, deadline, permit](bool inLoop, const CancelToken& token) {
+			if (isCancelled(token) == false && execute(conn, request, service, deadline, permit, inLoop, token)) {
+				return;
 			}
-			// 4. 处理完毕得到结果，组织响应，向客户端发送
-			return response(conn, request, result, RCode::RCODE_OK, inLoop);
+			if (token) removeToken(CancelKey(conn->id(), request->rid()));
 		};
-		if(service->useIOThread() || _thread_pool->getThreadNum() == 0){
-			std::cerr << "\nrun in io thread\n\n";
-			call(true);
+		// 只有协商了取消能力的连接才登记取消标记，其他连接不会发来取消帧
+		bool cancellable = cancelNegotiated(conn);
+		CancelKey key(conn->id(), request->rid());
+		WorkerPool::ptr pool = poolOf(service);
+		if(runInline(service, pool)){
+			// 异步方法等待应答期间可以被取消
+			call(true, cancellable && service->isAsync() ? addToken(key) : CancelToken());
 		}else{
-			_thread_pool->enqueue(std::bind(call, false));
+			// 进入工作线程队列的请求可以被取消：尚未开始的任务出队时直接跳过，正在执行的任务通过CallContext感知
+			CancelToken token = cancellable ? addToken(key, permit) : CancelToken();
+			bool queued = pool->tryEnqueue([call, token]() { call(false, token); });
+			// 排队已满时立即拒绝，不让请求在队列中无限等待
+			if (queued == false) {
+				if (token) removeToken(key);
+				ELOG("%s 工作线程池 %s 排队已满，拒绝请求 rid=%lu", request->method().c_str(), pool->name().c_str(), request->rid());
+				return response(conn, request, Json::Value(), RCode::RCODE_OVERLOADED, true);
+			}
 		}
     }
+    // 客户端取消请求，帧中的id即为要取消的请求id
+    void onCancelRequest(const BaseConnection::ptr& conn, CancelRequest::ptr& request) {
+		DLOG("收到取消请求 rid=%lu", request->rid());
+        _tokens->cancel(CancelKey(conn->id(), request->rid()));
+    }
+    // 批量rpc请求：每个调用在其方法绑定的线程池中执行，同一线程池的调用按线程数切分成若干段并行执行，全部完成后合并为一个响应帧
+    // 批量请求不绕过隔离线程池的线程与排队上限：线程池排满时，分给它的调用以RCODE_OVERLOADED应答
+    // 也不绕过并发限制：每个调用各自占用一份并发额度，超过上限的调用以RCODE_OVERLOADED应答，其余调用照常执行
+    void onBatchRequest(const BaseConnection::ptr& conn, BatchRequest::ptr& request) {
+        const Json::Value& calls = request->calls();
+        size_t count = calls.size();
+		DLOG("收到批量rpc请求 rid=%lu, 调用数=%zu", request->rid(), count);
+        auto batch = std::make_shared<BatchState>(conn, request, count, deadlineOf(request->timeout()));
+        // 按线程池分组，线程池数量很少，线性查找即可
+        std::vector<std::pair<WorkerPool::ptr, BatchIndices>> groups;
+        for (size_t i = 0; i < count; i++) {
+            auto service = _service_manager->select(calls[(Json::ArrayIndex)i][KEY_METHOD].asString());
+            if (service && admit(service, batch->permits[i]) == false) {
+                DLOG("%s 超过并发上限，拒绝批量请求中的调用 rid=%lu", service->method().c_str(), request->rid());
+                batch->results[i][KEY_RCODE] = (int)RCode::RCODE_OVERLOADED;
+                batch->results[i][KEY_RESULT] = Json::Value();
+                continue;
+            }
+            WorkerPool::ptr pool = service ? poolOf(service) : _thread_pool;
+            auto it = std::find_if(groups.begin(), groups.end(),
+                                   [&pool](const std::pair<WorkerPool::ptr, BatchIndices>& group) { return group.first == pool; });
+            if (it == groups.end()) {
+                groups.emplace_back(pool, std::make_shared<std::vector<size_t>>());
+                it = groups.end() - 1;
+            }
+            it->second->push_back(i);
+        }
+        std::vector<BatchSlice> slices;
+        for (auto& group : groups) {
+            size_t n = group.second->size();
+            size_t parts = std::max<size_t>(1, std::min(n, group.first->threads()));
+            for (size_t s = 0; s < parts; s++) {
+                slices.push_back(BatchSlice{group.first, group.second, n * s / parts, n * (s + 1) / parts});
+            }
+        }
+        if (slices.empty()) {
+            return responseBatch(conn, request, batch->results, true);
+        }
+        // 先记下全部段数再提交，避免先提交的段完成时误判为最后一段
+        batch->remaining.store(slices.size());
+        if (cancelNegotiated(conn)) {
+            batch->tokens = _tokens;
+            batch->token = addToken(CancelKey(conn->id(), request->rid()));
+        }
+        for (auto& slice : slices) {
+            if (slice.pool->threads() == 0) {
+                runSlice(batch, *slice.indices, slice.begin, slice.end, true);
+                continue;
+            }
+            BatchIndices indices = slice.indices;
+            size_t begin = slice.begin, end = slice.end;
+            bool queued = slice.pool->tryEnqueue([this, batch, indices, begin, end]() {
+                runSlice(batch, *indices, begin, end, false);
+            });
+            if (queued == false) {
+                ELOG("工作线程池 %s 排队已满，拒绝批量请求中的 %zu 个调用 rid=%lu", slice.pool->name().c_str(), end - begin, request->rid());
+                for (size_t i = begin; i < end; i++) {
+                    Json::Value& item = batch->results[(*indices)[i]];
+                    item[KEY_RCODE] = (int)RCode::RCODE_OVERLOADED;
+                    item[KEY_RESULT] = Json::Value();
+                    batch->permits[(*indices)[i]].reset();
+                }
+                finishSlice(batch, true);
+            }
+        }
+    }
     void registerMethod(const MethodDescribe::ptr& service) {
+        if (service->pool().empty() == false && poolOf(service) == _thread_pool) {
+            ELOG("%s 绑定的工作线程池 %s 不存在，使用默认线程池", service->method().c_str(), service->pool().c_str());
+        }
         return _service_manager->insert(service);
     }
+    // 创建独立的工作线程池，方法通过SDescribeFactory::setPool绑定；max_queue为排队上限，0表示不限制
+    void addPool(const std::string& name, size_t threads, size_t max_queue = 0) {
+        std::unique_lock<std::mutex> lock(_pool_mutex);
+        _pools[name] = std::make_shared<WorkerPool>(name, threads, max_queue);
+    }
+    // 默认线程池的排队上限，0表示不限制
+    void setMaxQueue(size_t max_queue) {
+        _thread_pool->setMaxQueue(max_queue);
+    }
+    // 开启服务端的自适应并发限制：所有方法的请求共享一个上限，平均排队时间超过target_queue_ms时减小上限
+    void enableConcurrencyLimit(int target_queue_ms = ConcurrencyLimiter::defaultTargetQueueMs,
+                                size_t max_limit = ConcurrencyLimiter::defaultMaxLimit) {
+        std::unique_lock<std::mutex> lock(_limiter_mutex);
+        _limiter = std::make_shared<ConcurrencyLimiter>(target_queue_ms, max_limit);
+        _limited = true;
+    }
+    // 单个方法的并发限制，与服务端的限制同时生效
+    void enableConcurrencyLimit(const std::string& method, int target_queue_ms = ConcurrencyLimiter::defaultTargetQueueMs,
+                                size_t max_limit = ConcurrencyLimiter::defaultMaxLimit) {
+        std::unique_lock<std::mutex> lock(_limiter_mutex);
+        _method_limiters[method] = std::make_shared<ConcurrencyLimiter>(target_queue_ms, max_limit);
+        _limited = true;
+    }
+    // method为空时返回服务端的统计，没有开启限制时各项为0
+    ConcurrencyLimiter::Stats concurrencyStats(const std::string& method = "") {
+        std::unique_lock<std::mutex> lock(_limiter_mutex);
+        ConcurrencyLimiter::ptr limiter = _limiter;
+        if (method.empty() == false) {
+            auto it = _method_limiters.find(method);
+            limiter = it == _method_limiters.end() ? ConcurrencyLimiter::ptr() : it->second;
+        }
+        lock.unlock();
+        return limiter ? limiter->stats() : ConcurrencyLimiter::Stats();
+    }
+    // 是否按执行耗时自动把方法放到io线程或工作线程中执行，默认开启
+    void setAdaptiveDispatch(bool enable) {
+        _adaptive = enable;
+    }
+    // 各方法当前的执行位置，用于观察自适应调度的结果
+    std::unordered_map<std::string, Placement> placements() {
+        std::unordered_map<std::string, Placement> result;
+        for (auto& service : _service_manager->methods()) {
+            Placement& placement = result[service->method()];
+            placement.io_thread = runInline(service, poolOf(service));
+            placement.adaptive = _adaptive && service->adaptive();
+            placement.avg_cost_us = service->avgCostUs();
+        }
+        return result;
+    }
 
    private:
-    void response(const BaseConnection::ptr& conn,
+    // 依次占用方法与服务端的并发额度，任一超过上限时返回false；没有开启限制时permit为空
+    bool admit(const MethodDescribe::ptr& service, LimiterPermit::ptr& permit) {
+        if (_limited.load() == false) {
+            return true;
+        }
+        ConcurrencyLimiter::ptr server, method;
+        {
+            std::unique_lock<std::mutex> lock(_limiter_mutex);
+            server = _limiter;
+            auto it = _method_limiters.find(service->method());
+            if (it != _method_limiters.end()) method = it->second;
+        }
+        if (method && method->acquire() == false) {
+            return false;
+        }
+        if (server && server->acquire() == false) {
+            if (method) method->release(-1);
+            return false;
+        }
+        if (server || method) {
+            permit = std::make_shared<LimiterPermit>(server, method);
+        }
+        return true;
+    }
+    // 耗时很短的方法直接在io线程中执行，省去切换到工作线程再切回io线程发送响应的开销
+    bool runInline(const MethodDescribe::ptr& service, const WorkerPool::ptr& pool) {
+        if (service->useIOThread() || pool->threads() == 0) {
+            return true;
+        }
+        return _adaptive && service->adaptive() && service->runInline();
+    }
+    void recordCost(const MethodDescribe::ptr& service, const std::chrono::steady_clock::time_point& start) {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (service->recordCost(ns)) {
+            ILOG("%s 平均耗时 %ldus，改为在%s中执行", service->method().c_str(), service->avgCostUs(),
+                 service->runInline() ? "io线程" : "工作线程");
+        }
+    }
+    WorkerPool::ptr poolOf(const MethodDescribe::ptr& service) {
+        if (service->pool().empty()) {
+            return _thread_pool;
+        }
+        std::unique_lock<std::mutex> lock(_pool_mutex);
+        auto it = _pools.find(service->pool());
+        return it == _pools.end() ? _thread_pool : it->second;
+    }
+    using CancelKey = CancelTable::Key;
+    static bool cancelNegotiated(const BaseConnection::ptr& conn) {
+        auto protocol = conn->protocol();
+        return protocol && protocol->negotiated(CAP_CANCEL);
+    }
+    static bool isCancelled(const CancelToken& token) {
+        return token && token->load();
+    }
+    CancelToken addToken(const CancelKey& key, const LimiterPermit::ptr& permit = LimiterPermit::ptr()) {
+        return _tokens->add(key, permit);
+    }
+    void removeToken(const CancelKey& key) {
+        _tokens->remove(key);
+    }
+
+    using Deadline = std::chrono::steady_clock::time_point;
+    static Deadline deadlineOf(int timeout_ms) {
+        if (timeout_ms <= 0) {
+            return Deadline::max();
+        }
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+    static bool expired(const Deadline& deadline) {
+        return deadline != Deadline::max() && std::chrono::steady_clock::now() >= deadline;
+    }
+    // 执行一个rpc请求，返回true表示请求交给了异步方法的应答器
+    bool execute(const BaseConnection::ptr& conn, const RpcRequest::ptr& request, const MethodDescribe::ptr& service,
+                 const Deadline& deadline, const LimiterPermit::ptr& permit, bool inLoop, const CancelToken& token) {
+		if (permit) permit->begin();
+		if (expired(deadline)) {
+			ILOG("%s 请求排队超时，不再处理 rid=%lu", request->method().c_str(), request->rid());
+			return false;
+		}
+		if (service->isAsync()) {
+			callAsync(conn, request, service, deadline, token);
+			return true;
+		}
+		// 3. 调用业务回调接口进行业务处理
+		Json::Value result;
+		RCode rcode;
+		{
+			CallContext::Scope scope(token);
+			bool measure = service->adaptive();
+			auto start = measure ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+			rcode = service->call(request->params(), result);
+			if (measure) recordCost(service, start);
+		}
+		if (token && token->load()) {
+			DLOG("%s 请求已被取消，不再响应 rid=%lu", request->method().c_str(), request->rid());
+			return false;
+		}
+		if (rcode != RCode::RCODE_OK) {
+			ELOG("%s 服务调用失败：%s", request->method().c_str(), errReason(rcode).c_str());
+			response(conn, request, Json::Value(), rcode, inLoop);
+			return false;
+		}
+		// 4. 处理完毕得到结果，组织响应，向客户端发送
+		response(conn, request, result, RCode::RCODE_OK, inLoop);
+		return false;
+    }
+    // 调用异步方法：应答器在任意线程中应答时移除取消标记并发送响应
+    // 应答器可能比路由器存活得更久(业务保存后在路由器释放后才应答或析构)，应答时只访问自己持有的对象
+    void callAsync(const BaseConnection::ptr& conn, const RpcRequest::ptr& request,
+                   const MethodDescribe::ptr& service, const Deadline& deadline, const CancelToken& token) {
+        CancelTable::ptr tokens = _tokens;
+        auto send = [tokens, conn, request, service, deadline, token](RCode rcode, const Json::Value& result) {
+            if (token) tokens->remove(CancelKey(conn->id(), request->rid()));
+            if (token && token->load()) {
+                DLOG("%s 请求已被取消，不再响应 rid=%lu", request->method().c_str(), request->rid());
+                return;
+            }
+            if (expired(deadline)) {
+                ILOG("%s 请求应答时已超时，不再响应 rid=%lu", request->method().c_str(), request->rid());
+                return;
+            }
+            if (rcode == RCode::RCODE_OK && service->resultCheck(result) == false) {
+                ELOG("异步方法应答的结果校验失败！");
+                return response(conn, request, Json::Value(), RCode::RCODE_INTERNAL_ERROR);
+            }
+            if (rcode != RCode::RCODE_OK) {
+                ELOG("%s 服务调用失败：%s", request->method().c_str(), errReason(rcode).c_str());
+                return response(conn, request, Json::Value(), rcode);
+            }
+            response(conn, request, result, RCode::RCODE_OK);
+        };
+        CallContext::Scope scope(token);
+        service->callAsync(request->params(), std::make_shared<Responder>(send, token));
+    }
+
+    // 一个批量请求在各个线程池间共享的状态，最后完成的一段或异步调用负责发送响应
+    // 异步调用的应答可能晚于路由器释放，完成批量请求时只访问这里持有的对象
+    struct BatchState {
+        using ptr = std::shared_ptr<BatchState>;
+        BatchState(const BaseConnection::ptr& c, const BatchRequest::ptr& req, size_t count, const Deadline& d)
+            : conn(c), request(req), results(count), permits(count), deadline(d) {}
+        BaseConnection::ptr conn;
+        BatchRequest::ptr request;
+        std::vector<Json::Value> results;
+        std::vector<LimiterPermit::ptr> permits;  // 各个调用占用的并发额度，调用结束时归还
+        Deadline deadline;
+        CancelTable::ptr tokens;
+        CancelToken token;
+        std::atomic<size_t> remaining{0};  // 尚未完成的段数与尚未应答的异步调用数
+    };
+    using BatchIndices = std::shared_ptr<std::vector<size_t>>;
+    // 交给同一个线程池的调用中的一段：indices[begin, end)
+    struct BatchSlice {
+        WorkerPool::ptr pool;
+        BatchIndices indices;
+        size_t begin;
+        size_t end;
+    };
+    void runSlice(const BatchState::ptr& batch, const std::vector<size_t>& indices, size_t begin, size_t end, bool inLoop) {
+        // 超时与取消都是单调的：任何一段发现超时或取消，最后完成的一段也必然发现，不会发送残缺的响应
+        {
+            CallContext::Scope scope(batch->token);
+            const Json::Value& calls = batch->request->calls();
+            size_t i = begin;
+            for (; i < end && expired(batch->deadline) == false && isCancelled(batch->token) == false; i++) {
+                invoke(batch, calls[(Json::ArrayIndex)indices[i]], indices[i]);
+            }
+            // 超时或取消后不再执行的调用立即归还并发额度
+            for (; i < end; i++) {
+                batch->permits[indices[i]].reset();
+            }
+        }
+        finishSlice(batch, inLoop);
+    }
+    static void finishSlice(const BatchState::ptr& batch, bool inLoop) {
+        if (batch->remaining.fetch_sub(1) != 1) {
+            return;
+        }
+        if (batch->token) batch->tokens->remove(CancelKey(batch->conn->id(), batch->request->rid()));
+        if (expired(batch->deadline) || isCancelled(batch->token)) {
+            ILOG("批量请求已超时或被取消，不再响应 rid=%lu", batch->request->rid());
+            return;
+        }
+        responseBatch(batch->conn, batch->request, batch->results, inLoop);
+    }
+    // 执行批量请求中的第index个调用，状态码与结果写入batch->results[index]
+    void invoke(const BatchState::ptr& batch, const Json::Value& call, size_t index) {
+        Json::Value& item = batch->results[index];
+        // 与单个请求一致：同步方法执行完毕时归还并发额度，异步方法交给应答器后即归还
+        LimiterPermit::ptr permit = std::move(batch->permits[index]);
+        if (permit) permit->begin();
+        const Json::Value& params = call[KEY_PARAMS];
+        Json::Value result;
+        RCode rcode = RCode::RCODE_OK;
+        auto service = _service_manager->select(call[KEY_METHOD].asString());
+        if (service.get() == nullptr) {
+            ELOG("%s 服务未找到！", call[KEY_METHOD].asCString());
+            rcode = RCode::RCODE_NOT_FOUND_SERVICE;
+        } else if (service->paramCheck(params) == false) {
+            ELOG("%s 服务参数校验失败！", call[KEY_METHOD].asCString());
+            rcode = RCode::RCODE_INVALID_PARAMS;
+        } else if (service->isAsync()) {
+            // 异步方法不占用工作线程等待应答：先计入未完成数，应答时写入结果，最后一个完成的负责发送批量响应
+            batch->remaining.fetch_add(1);
+            service->callAsync(params, std::make_shared<Responder>([batch, service, index](RCode rcode, const Json::Value& res) {
+                if (rcode == RCode::RCODE_OK && service->resultCheck(res) == false) {
+                    ELOG("异步方法应答的结果校验失败！");
+                    rcode = RCode::RCODE_INTERNAL_ERROR;
+                }
+                Json::Value& item = batch->results[index];
+                item[KEY_RCODE] = (int)rcode;
+                item[KEY_RESULT] = rcode == RCode::RCODE_OK ? res : Json::Value();
+                finishSlice(batch, false);
+            }, batch->token));
+            return;
+        } else {
+            rcode = service->call(params, result);
+        }
+        item[KEY_RCODE] = (int)rcode;
+        item[KEY_RESULT] = rcode == RCode::RCODE_OK ? std::move(result) : Json::Value();
+    }
+    static void responseBatch(const BaseConnection::ptr& conn,
+                       const BatchRequest::ptr& req,
+                       std::vector<Json::Value>& items,
+                       bool inLoop) {
+        Json::Value results(Json::arrayValue);
+        for (auto& item : items) {
+            results.append(std::move(item));
+        }
+        auto msg = MessageFactory::create<BatchResponse>();
+        msg->setId(req->rid());
+        msg->setRCode(RCode::RCODE_OK);
+        msg->setResults(std::move(results));
+		DLOG("发送批量rpc响应 rid=%lu", msg->rid());
+        if(inLoop) conn->send(msg);
+		else conn->sendInLoop(msg);
+    }
+    static void response(const BaseConnection::ptr& conn,
                   const RpcRequest::ptr& req,
                   const Json::Value& res,
                   RCode rcode,
@@ -189,16 +890,23 @@ class RpcRouter {
         msg->setMType(myrpc::MType::RSP_RPC);
         msg->setRCode(rcode);
         msg->setResult(res);
-		std::string json;
-		myrpc::JSON::serialize(msg->result(), json);
-		DLOG("发送rpc响应 orid=%s, rrid=%s", req->rid().c_str(), msg->rid().c_str());
+		DLOG("发送rpc响应 orid=%lu, rrid=%lu", req->rid(), msg->rid());
         if(inLoop) conn->send(msg);
 		else conn->sendInLoop(msg);
     }
 
    private:
     ServiceManager::ptr _service_manager;
-	ThreadPool::ptr _thread_pool;
+    CancelTable::ptr _tokens;  // 工作线程中排队或执行中、可以被取消的请求
+    std::atomic<bool> _adaptive{true};
+    std::atomic<bool> _limited{false};
+    std::mutex _limiter_mutex;
+    ConcurrencyLimiter::ptr _limiter;  // 服务端的并发限制
+    std::unordered_map<std::string, ConcurrencyLimiter::ptr> _method_limiters;
+    // 线程池放在最后，先于取消标记析构：析构时执行剩余任务仍会访问取消标记
+	WorkerPool::ptr _thread_pool;  // 默认线程池，未绑定线程池的方法使用
+    std::mutex _pool_mutex;
+    std::unordered_map<std::string, WorkerPool::ptr> _pools;  // 按名称索引的独立线程池
 };
 
 }  // namespace server
@@ -17,6 +17,13 @@ class RpcServer : public Server {
         auto rpc_req_cb = std::bind(&RpcRouter::onRpcRequest, _router.get(),
                                     std::placeholders::_1, std::placeholders::_2);
         registerHandler<RpcRequest>(MType::REQ_RPC, rpc_req_cb);
+        auto batch_req_cb = std::bind(&RpcRouter::onBatchRequest, _router.get(),
+                                      std::placeholders::_1, std::placeholders::_2);
+        registerHandler<BatchRequest>(MType::REQ_RPC_BATCH, batch_req_cb);
+        auto cancel_req_cb = std::bind(&RpcRouter::onCancelRequest, _router.get(),
+                                       std::placeholders::_1, std::placeholders::_2);
+        registerHandler<CancelRequest>(MType::REQ_CANCEL, cancel_req_cb);
+        addCapabilities(CAP_BATCH | CAP_CANCEL);
         auto svc_req_cb = std::bind(&RpcServer::onServiceRequest, this,
                                     std::placeholders::_1, std::placeholders::_2);
         registerHandler<ServiceRequest>(MType::REQ_SERVICE, svc_req_cb);
@@ -27,6 +34,48 @@ class RpcServer : public Server {
         _router->registerMethod(service);
     }
 
+	// 隔离的工作线程池：绑定到它的方法(SDescribeFactory::setPool)只占用它的线程和队列，需在注册方法前创建
+	void addPool(const std::string& name, size_t threads, size_t max_queue = 0) {
+		_router->addPool(name, threads, max_queue);
+	}
+	// 默认工作线程池的排队上限，排满后新请求以RCODE_OVERLOADED拒绝
+	void setMaxQueue(size_t max_queue) {
+		_router->setMaxQueue(max_queue);
+	}
+	// 自适应并发限制：同时处理的请求超过上限时立即以RCODE_OVERLOADED拒绝，上限随排队时间自动调整
+	void enableConcurrencyLimit(int target_queue_ms = ConcurrencyLimiter::defaultTargetQueueMs,
+	                            size_t max_limit = ConcurrencyLimiter::defaultMaxLimit) {
+		_router->enableConcurrencyLimit(target_queue_ms, max_limit);
+	}
+	void enableConcurrencyLimit(const std::string& method, int target_queue_ms = ConcurrencyLimiter::defaultTargetQueueMs,
+	                            size_t max_limit = ConcurrencyLimiter::defaultMaxLimit) {
+		_router->enableConcurrencyLimit(method, target_queue_ms, max_limit);
+	}
+	ConcurrencyLimiter::Stats concurrencyStats(const std::string& method = "") {
+		return _router->concurrencyStats(method);
+	}
+	// 耗时很短的方法自动在io线程中执行，变慢后退回工作线程；关闭后只有指定了io线程的方法在io线程中执行
+	void setAdaptiveDispatch(bool enable) {
+		_router->setAdaptiveDispatch(enable);
+	}
+	std::unordered_map<std::string, RpcRouter::Placement> placements() {
+		return _router->placements();
+	}
+
+	// 类型化注册：server->registerMethod<int64_t(int64_t, int64_t)>("Add", Add, {"num1", "num2"})
+	template <typename Sig, typename F>
+	bool registerMethod(const std::string& method, F&& fn, const std::vector<std::string>& names = {}, bool use_io_thread = false) {
+		SDescribeFactory sdf;
+		sdf.setMethodName(method);
+		if (sdf.setTypedCallback<Sig>(std::forward<F>(fn), names) == false) {
+			ELOG("%s 方法注册失败！", method.c_str());
+			return false;
+		}
+		sdf.setUseIOThread(use_io_thread);
+		_router->registerMethod(sdf.build());
+		return true;
+	}
+
 	void onServiceRequest(const BaseConnection::ptr& conn, const ServiceRequest::ptr& req){
 		auto optype = req->optype();
 		if(optype == ServiceOptype::SERVICE_DETECT){
@@ -42,7 +91,7 @@ class RpcServer : public Server {
 		rsp->setId(req->rid());
 		rsp->setRCode(RCode::RCODE_OK);
 		rsp->setIdleCount(idleCount());
-		DLOG("回复心跳检测，idle=%d， msgidle=%d, rid=%s", idleCount(), rsp->idleCount(), rsp->rid().c_str());
+		DLOG("回复心跳检测，idle=%d， msgidle=%d, rid=%lu", idleCount(), rsp->idleCount(), rsp->rid());
 		conn->send(std::dynamic_pointer_cast<BaseMessage>(rsp));
 	}
 
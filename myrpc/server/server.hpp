@@ -12,7 +12,7 @@ class Server : public MuduoServer {
     Server(int port, int max_connections = (1 << 16))
         : MuduoServer(port, max_connections),
 		_dispatcher(std::make_shared<Dispatcher>()) {
-        auto msg_cb = std::bind(&Dispatcher::onMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
+        auto msg_cb = std::bind(&Server::onMessage, this, std::placeholders::_1, std::placeholders::_2);
         setMessageCallback(msg_cb);
     }
 
@@ -20,9 +20,40 @@ class Server : public MuduoServer {
 	void registerHandler(MType mtype, std::function<void(const BaseConnection::ptr&, std::shared_ptr<T>&)> func){
 		return _dispatcher->registerHandler<T>(mtype, func);
 	}
+	// 声明由上层提供的能力(如批量调用)，握手时与协议层能力一起通告给对端
+	void addCapabilities(uint32_t caps) {
+		_capabilities |= caps;
+	}
 
    private:
+	// 握手请求在这里统一处理，其余消息交给dispatcher分发
+	void onMessage(const BaseConnection::ptr& conn, BaseMessage::ptr& msg) {
+		if (msg->mtype() == MType::REQ_SERVICE) {
+			auto req = std::dynamic_pointer_cast<ServiceRequest>(msg);
+			if (req && req->optype() == ServiceOptype::SERVICE_HANDSHAKE) {
+				return onHandshake(conn, req);
+			}
+		}
+		_dispatcher->onMessage(conn, msg);
+	}
+
+	void onHandshake(const BaseConnection::ptr& conn, const ServiceRequest::ptr& req) {
+		auto protocol = conn->protocol();
+		uint32_t caps = req->capabilities() & (protocol->capabilities() | _capabilities);
+		int version = std::min(req->version(), PROTOCOL_VERSION);
+		DLOG("握手：版本 %d，能力 %u", version, caps);
+		auto rsp = std::make_shared<ServiceResponse>();
+		rsp->setId(req->rid());
+		rsp->setRCode(RCode::RCODE_OK);
+		rsp->setOptype(ServiceOptype::SERVICE_HANDSHAKE);
+		rsp->setVersion(version);
+		rsp->setCapabilities(caps);
+		protocol->setPeerCapabilities(caps);
+		conn->send(std::dynamic_pointer_cast<BaseMessage>(rsp));
+	}
+
     Dispatcher::ptr _dispatcher;
+	uint32_t _capabilities = 0;
 };
 
 }  // namespace server
@@ -100,6 +100,20 @@ class HostManager {
 		return false;
 	}
 
+	// 方法当前所有有空闲量的主机，只读查询，不分配主机也不改变空闲量
+	std::vector<Address> providers(const std::string& method){
+		std::unique_lock<std::mutex> lock(_mutex);
+		std::vector<Address> hosts;
+		auto it = _method_hosts.find(method);
+		if(it == _method_hosts.end()){
+			return hosts;
+		}
+		for(auto &mhost : it->second){
+			if(mhost.first > 0) hosts.push_back(mhost.second);
+		}
+		return hosts;
+	}
+
 	void setServiceAppearCallback(const ServiceAppearCallback& cb){
 		std::unique_lock<std::mutex> lock(_mutex);
 		_service_appear_cb = cb;
@@ -223,7 +237,7 @@ class HostManager {
         cli->send(std::dynamic_pointer_cast<BaseMessage>(req), bas_rsp);
 		auto rsp = std::dynamic_pointer_cast<ServiceResponse>(bas_rsp);
         if (rsp->rcode() == RCode::RCODE_OK) {
-			DLOG("探测成功,idle=%d, rid=%s", rsp->idleCount(), bas_rsp->rid().c_str());
+			DLOG("探测成功,idle=%d, rid=%lu", rsp->idleCount(), bas_rsp->rid());
             idle = rsp->idleCount();
             return true;
         }
@@ -493,13 +507,17 @@ class ServiceRegistry {
 				_service_manager->wait(msg->method());
 				return responseRCode(msg->rid(), conn, RCode::RCODE_NOT_FOUND_SERVICE);
 			}
+		} else if (optype == ServiceOptype::SERVICE_PROVIDERS) {
+            DLOG("收到 主机列表 请求");
+			// 与服务发现不同，不登记发现者也不消耗空闲量，已经发现过该方法的客户端同样可以查询
+			return responseHosts(msg->rid(), conn, msg->method(), _service_manager->providers(msg->method()));
 		} else {
             ELOG("收到 %d 号请求，忽略", static_cast<int>(optype));
 			return responseRCode(msg->rid(), conn, RCode::RCODE_INVALID_OPTYPE);
 		}
     }
 
-	void responseRCode(std::string rid, const BaseConnection::ptr& conn, RCode code){
+	void responseRCode(RequestId rid, const BaseConnection::ptr& conn, RCode code){
 		auto rsp = std::make_shared<ServiceResponse>();
 		rsp->setId(rid);
 		rsp->setRCode(code);
@@ -507,7 +525,7 @@ class ServiceRegistry {
 		conn->send(std::dynamic_pointer_cast<BaseMessage>(rsp));
 	}
 
-	void responseHost(std::string rid, const BaseConnection::ptr& conn, const std::string& method, const Address& host){
+	void responseHost(RequestId rid, const BaseConnection::ptr& conn, const std::string& method, const Address& host){
 		auto rsp = std::make_shared<ServiceResponse>();
 		rsp->setId(rid);
 		rsp->setRCode(RCode::RCODE_OK);
@@ -517,6 +535,16 @@ class ServiceRegistry {
 		conn->send(std::dynamic_pointer_cast<BaseMessage>(rsp));
 	}
 
+	void responseHosts(RequestId rid, const BaseConnection::ptr& conn, const std::string& method, const std::vector<Address>& hosts){
+		auto rsp = std::make_shared<ServiceResponse>();
+		rsp->setId(rid);
+		rsp->setRCode(RCode::RCODE_OK);
+		rsp->setOptype(ServiceOptype::SERVICE_PROVIDERS);
+		rsp->setMethod(method);
+		rsp->setHosts(hosts);
+		conn->send(std::dynamic_pointer_cast<BaseMessage>(rsp));
+	}
+
 	void requestUpdate(const BaseConnection::ptr& conn, const std::string& method, const Address& host, ServiceOptype optype){
 		auto req = std::make_shared<ServiceRequest>();
 		req->setOptype(optype);